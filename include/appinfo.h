@@ -9,11 +9,21 @@ class AppInfo {
 public:
     AppInfo(const std::vector<uint8_t>& data);
 
+    uint64_t signature() const { return mSignature; }
+    uint32_t version() const { return mVersion; }
+    uint32_t length() const { return mLength; }
+
     const std::string& appVersion() const { return mAppVersion.second; }
+    const std::string& appDescription() const { return mAppDescription.second; }
     const std::string& bootloaderVersion() const { return mBootloaderVersion.second; }
+    const std::string& bootloaderDescription() const { return mBootloaderDescription.second; }
 
     std::vector<uint8_t> data() const;
 
+    // Every field, as the device would hold it after flashing
+    bool operator==(const AppInfo& o) const { return data() == o.data(); }
+    bool operator!=(const AppInfo& o) const { return !(*this == o); }
+
 private:
     uint64_t mSignature;
     uint32_t mVersion;
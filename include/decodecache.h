@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ext/bufferview.h"
+#include "ext/timer.h"
+#include "flashfile.h"
+#include "utils/sha256.h"
+
+// Plaintext recovered by earlier decodes (.gbdc), keyed by the address and SHA-256 of each ciphered record,
+// so an interrupted decode picks up where it stopped and a new revision only costs its changed records.
+// Records are appended as they are recovered, each in a single write so decodes sharing the file don't
+// interleave them, and synced to disk in batches.
+//
+// Layout, little endian: "GBDC", version (4), then per record address (4), key (32), size (1), plaintext and
+// the first 4 bytes of the SHA-256 of everything before them in the record. Records torn by a crash are
+// skipped on open, the ones after them are still loaded.
+class DecodeCache {
+public:
+    static constexpr auto Tag = "DecodeCache";
+
+public:
+    using Key = utils::SHA256::Digest;
+
+public:
+    DecodeCache(std::string path);
+    ~DecodeCache();
+
+    DecodeCache(const DecodeCache&) = delete;
+    DecodeCache& operator=(const DecodeCache&) = delete;
+
+    // Loads the records already in the file and opens it for appending
+    bool open();
+
+    static Key key(const FlashFile::Record& record);
+
+    const std::vector<uint8_t>* find(uint32_t address, const Key& key) const;
+    bool add(uint32_t address, const Key& key, const uint8_t* data, size_t size);
+    // Flushes the records added since the last sync down to the disk
+    bool sync();
+
+    size_t size() const { return mRecords.size(); }
+
+private:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t CHECK_SIZE = 4;
+    // Records or milliseconds between syncs, whichever comes first
+    static constexpr uint32_t SYNC_RECORDS = 64;
+    static constexpr uint64_t SYNC_INTERVAL = 1000;
+
+    bool load();
+    // Length of the record at the start of view, 0 if it is torn
+    static size_t parse(ext::BufferView view, uint32_t& address, Key& key, ext::BufferView& data);
+
+private:
+    std::string mPath;
+    int mFd = -1;
+    std::map<std::pair<uint32_t, Key>, std::vector<uint8_t>> mRecords;
+
+    uint32_t mUnsynced = 0;
+    ext::Timer mSinceSync;
+};
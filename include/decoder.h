@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "decodecache.h"
+#include "flasher.h"
+#include "flashfile.h"
+#include "memoryimage.h"
+#include "probemodel.h"
+
+// Recovers the ciphered application records of an image from several devices that all hold it. Every
+// device starts on its own contiguous share of the records and, once that runs dry, steals the upper half of
+// the largest share left. Records are handed to the sink in address order as soon as all before them are in,
+// the ones found in the cache right away.
+class Decoder {
+public:
+    static constexpr auto Tag = "Decoder";
+
+public:
+    // Probes are ordered by copies of model, which learns the recovered bytes as they are written out.
+    // Records are looked up in and added to cache if there is one.
+    Decoder(const FlashFile& file, ProbeModel& model, const MemoryImage* reference = nullptr, DecodeCache* cache = nullptr);
+
+    // Runs one thread per flasher, records a device fails on are retried on another one
+    bool run(const std::vector<Flasher*>& flashers, const Flasher::Sink& sink);
+
+private:
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+
+    bool next(size_t worker, size_t& index);
+    void complete(size_t index, std::vector<uint8_t> data, const Flasher::Sink& sink);
+    void write(std::unique_lock<std::mutex>& lock, const Flasher::Sink& sink);
+    void fail(size_t worker, size_t index);
+    void work(size_t worker, Flasher& flasher, const Flasher::Sink& sink);
+
+private:
+    const FlashFile& mFile;
+    ProbeModel& mModel;
+    const MemoryImage* mReference;
+    DecodeCache* mCache;
+    std::vector<const FlashFile::Record*> mRecords;
+    std::vector<DecodeCache::Key> mKeys;
+    // Records not in the cache, the shares are ranges of it
+    std::vector<size_t> mPending;
+
+    std::mutex mMutex;
+    // Signalled when a record completes, fails or the decode gives up
+    std::condition_variable mChanged;
+    std::vector<Range> mRanges;
+    // Records given back by a device that failed them, each is tried on one more device
+    std::vector<size_t> mRetry;
+    std::vector<uint8_t> mAttempts;
+    std::vector<std::vector<uint8_t>> mResults;
+    std::vector<bool> mDone;
+    size_t mWritten = 0;
+    size_t mInFlight = 0;
+    bool mWriting = false;
+    bool mFailed = false;
+    // Kept apart so appending to the cache doesn't hold up the other workers
+    std::mutex mCacheMutex;
+    std::vector<uint32_t> mDecoded;
+    std::vector<uint32_t> mStolen;
+};
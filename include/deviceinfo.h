@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include <vector>
 
 #include "memoryinfo.h"
@@ -14,12 +16,33 @@ public:
     const std::vector<MemoryInfo>& memInfo() const { return mMemInfo; }
 
     uint32_t address(MemoryInfo::Type type) const;
+    // Type of the shortest block holding the whole range, NONE if there is none. An empty range is taken
+    // to cover its first address.
     MemoryInfo::Type memoryType(uint32_t addr, uint32_t size) const;
 
+    // Checks every record lies inside a block of its type and the app info fits its block
     bool validateFlashFile(const FlashFile& file) const;
 
+private:
+    static constexpr uint32_t MAX_BLOCKS = 6;
+
+    // Stretch of addresses covered by the same blocks, indices into mMemInfo from shortest to longest
+    struct Interval {
+        uint64_t start;
+        uint64_t end;
+        uint8_t count;
+        std::array<uint8_t, MAX_BLOCKS> blocks;
+    };
+
+    void buildIntervals();
+    // The interval holding addr, or nullptr in a gap between blocks
+    const Interval* interval(uint32_t addr) const;
+    uint64_t end(uint8_t block) const { return static_cast<uint64_t>(mMemInfo[block].address) + mMemInfo[block].length; }
+
 private:
     uint8_t mFieldSize;
     uint8_t mBytesPerAddress;
     std::vector<MemoryInfo> mMemInfo;
+    // Sorted and non-overlapping
+    std::vector<Interval> mIntervals;
 };
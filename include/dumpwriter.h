@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Buffered sink for memory read back from a device, written as raw binary or as Intel HEX with 16 byte
+// data records. A path of "-" writes to stdout.
+class DumpWriter {
+public:
+    static constexpr auto Tag = "DumpWriter";
+
+public:
+    enum Format {
+        FORMAT_BIN,
+        FORMAT_HEX,
+    };
+
+public:
+    DumpWriter(const std::string& path, Format format);
+    ~DumpWriter();
+
+    // HEX for .hex and .ihex files and stdout, binary otherwise
+    static Format formatOf(const std::string& path);
+
+    operator bool() const { return mFile != nullptr; }
+
+    // Addresses must increase, gaps in a binary file are filled with 0xFF
+    bool write(uint32_t address, const uint8_t* data, size_t size);
+    // Writes the end of file record and flushes everything
+    bool close();
+
+private:
+    static constexpr size_t LINE_SIZE = 16;
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    void writeLine();
+    void record(uint8_t type, uint16_t offset, const uint8_t* data, size_t size);
+    bool flush();
+
+private:
+    FILE* mFile = nullptr;
+    Format mFormat;
+    std::string mBuffer;
+    bool mOk = true;
+
+    // Next address expected in a binary file
+    bool mStarted = false;
+    uint32_t mNext = 0;
+
+    // Data record being filled and the upper address bits last set with an extended address record
+    std::vector<uint8_t> mLine;
+    uint32_t mLineAddress = 0;
+    uint32_t mBase = 0xFFFFFFFFU;
+};
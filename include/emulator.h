@@ -0,0 +1,59 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hid.h"
+#include "memoryinfo.h"
+
+// Software model of the Gameball bootloader, served through HID::Bus so Flasher can run without hardware.
+// Ciphered commands use a fixed address-derived keystream in place of the real cipher. CMD_GET_DATA refuses
+// to read the boot flash and anything programmed with ciphered writes.
+class Emulator : public HID::Bus {
+public:
+    static constexpr auto Tag = "Emulator";
+
+public:
+    class Unit;
+
+    class Device : public HID::Device {
+    public:
+        static constexpr auto Tag = "Emulator::Device";
+
+    public:
+        Device(std::string path, std::shared_ptr<Unit> unit, uint16_t pid);
+        ~Device() override;
+
+        bool open() override;
+        void close() override;
+        bool isOpen() const override;
+        int fd() const override;
+
+    protected:
+        int readReport(uint8_t* data, size_t size, int timeout) override;
+        int writeReport(const uint8_t* data, size_t size) override;
+
+    private:
+        std::shared_ptr<Unit> mUnit;
+        uint16_t mPid;
+        uint32_t mGeneration = 0;
+        bool mOpen = false;
+    };
+
+public:
+    Emulator(uint32_t units = 1, std::vector<MemoryInfo> memInfo = defaultMemInfo());
+
+    static std::vector<MemoryInfo> defaultMemInfo();
+    static uint8_t cipher(uint32_t address);
+
+    // Delay between a report being written and its reply becoming readable
+    void setLatency(std::chrono::microseconds latency);
+
+    std::vector<HID::Entry> enumerate(uint16_t vid, uint16_t pid, int interfaceNum) override;
+    std::shared_ptr<HID::Device> device(const std::string& path) override;
+
+private:
+    std::vector<std::shared_ptr<Unit>> mUnits;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "deviceinfo.h"
+#include "ext/rtt.h"
+#include "flasher.h"
+#include "flashfile.h"
+#include "hid.h"
+
+// Flashes many bootloaders at once from a single thread, advancing each device as its replies arrive
+class Engine {
+public:
+    static constexpr auto Tag = "Engine";
+
+public:
+    struct Result {
+        std::string path;
+        bool success;
+        uint64_t ms;
+        uint32_t reports;
+        std::chrono::microseconds srtt;
+        std::string error;
+    };
+
+public:
+    Engine(const FlashFile& file, const DeviceInfo& info, bool reset = true);
+
+    bool add(std::shared_ptr<HID::Device> dev);
+    // Every device in boot mode, or only the one with this serial number
+    uint32_t addBootDevices(const std::string& serial = {});
+
+    // Runs every added device through erase, write, verify, app info, sign and reset
+    std::vector<Result> run();
+
+private:
+    struct Step {
+        uint8_t cmd;
+        const FlashFile::Record* record;
+        std::vector<uint8_t> data;
+        bool result;
+        bool reply;
+    };
+
+    struct Slot {
+        std::shared_ptr<HID::Device> dev;
+        size_t step = 0;
+        bool active = true;
+        HID::Report request{};
+        HID::Report reply{};
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point sent;
+        std::chrono::steady_clock::time_point deadline;
+        ext::Rtt rtt = Flasher::commandRtt();
+        ext::Rtt programRtt = Flasher::programRtt();
+        ext::Rtt eraseRtt = Flasher::eraseRtt();
+        Result result;
+    };
+
+    // The slot's estimate for the command's class, as Flasher picks it
+    static ext::Rtt& rtt(Slot& slot, uint8_t cmd);
+
+    void post(Slot& slot);
+    void handle(Slot& slot);
+    void finish(Slot& slot, bool success, std::string error = {});
+
+private:
+    std::map<MemoryInfo::Type, std::vector<FlashFile::Record>> mRecords;
+    std::map<MemoryInfo::Type, std::vector<uint8_t>> mScratch;
+    std::vector<Step> mProgram;
+    std::vector<Slot> mSlots;
+    int mEpoll = -1;
+    uint32_t mActive = 0;
+};
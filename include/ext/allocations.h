@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ext {
+// Heap allocations made by the calling thread. Only counted when built with COUNT_ALLOCATIONS, which
+// replaces the global operator new, and always 0 otherwise
+class Allocations {
+public:
+    static constexpr auto Tag = "Allocations";
+
+    // Stops counting on this thread while in scope, for work that stands in for the other end of a transport
+    class Pause {
+    public:
+        Pause();
+        ~Pause();
+
+        Pause(const Pause&) = delete;
+        Pause& operator=(const Pause&) = delete;
+    };
+
+public:
+    static uint64_t count();
+};
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace ext {
+// Blocking FIFO between one producer and one consumer that holds at most capacity items, counting how
+// often each side had to wait for the other. A producer that found the queue full sleeps until it has
+// drained to half, so the two sides don't wake each other for every item.
+template<typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) : mCapacity(capacity > 0 ? capacity : 1) {}
+
+    // Waits for room, returns false once the queue is closed
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mItems.size() >= mCapacity && !mClosed) {
+            ++mPushStalls;
+            mNotFull.wait(lock, [this]() { return mItems.size() <= mCapacity / 2 || mClosed; });
+        }
+
+        if (mClosed) {
+            return false;
+        }
+
+        mItems.push_back(std::move(item));
+        mMaxDepth = std::max(mMaxDepth, mItems.size());
+        if (mItems.size() == 1) {
+            mNotEmpty.notify_one();
+        }
+
+        return true;
+    }
+
+    // Waits for an item, returns false once the queue is closed and drained
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mItems.empty() && !mClosed) {
+            ++mPopStalls;
+            mNotEmpty.wait(lock, [this]() { return !mItems.empty() || mClosed; });
+        }
+
+        if (mItems.empty()) {
+            return false;
+        }
+
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        if (mItems.size() == mCapacity / 2) {
+            mNotFull.notify_one();
+        }
+
+        return true;
+    }
+
+    // Wakes both sides, items already queued can still be popped
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mClosed = true;
+        mNotFull.notify_all();
+        mNotEmpty.notify_all();
+    }
+
+    // Drops the items left and reopens the queue, the statistics are kept
+    void reset()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mItems.clear();
+        mClosed = false;
+    }
+
+    size_t capacity() const { return mCapacity; }
+    size_t maxDepth() const { std::unique_lock<std::mutex> lock(mMutex); return mMaxDepth; }
+    uint32_t pushStalls() const { std::unique_lock<std::mutex> lock(mMutex); return mPushStalls; }
+    uint32_t popStalls() const { std::unique_lock<std::mutex> lock(mMutex); return mPopStalls; }
+
+private:
+    const size_t mCapacity;
+    mutable std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+    std::deque<T> mItems;
+    bool mClosed = false;
+
+    size_t mMaxDepth = 0;
+    uint32_t mPushStalls = 0;
+    uint32_t mPopStalls = 0;
+};
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ext {
+// Non-owning little endian reader over a byte range, the counterpart of BufferStream for data that is
+// already in memory and must not be copied
+class BufferView {
+public:
+    BufferView() = default;
+    BufferView(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+    BufferView(const std::vector<uint8_t>& data) : BufferView(data.data(), data.size()) {}
+    template<size_t N>
+    BufferView(const std::array<uint8_t, N>& data) : BufferView(data.data(), N) {}
+
+    const uint8_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    bool eof() const { return mOffset >= mSize; }
+    size_t offset() const { return mOffset; }
+    size_t remain() const { return eof() ? 0 : mSize - mOffset; }
+
+    BufferView& skip(size_t count) { mOffset += count; return *this; }
+    BufferView& reset(size_t pos = 0) { mOffset = pos; return *this; }
+
+    uint8_t readUInt8() { return eof() ? 0U : mData[mOffset++]; }
+    uint16_t readUInt16() { uint16_t lo = readUInt8(); return lo | (readUInt8() << 8U); }
+    uint32_t readUInt32() { uint32_t lo = readUInt16(); return lo | (static_cast<uint32_t>(readUInt16()) << 16U); }
+
+    // Returns a view over the next count bytes (or the remainder) and skips past them
+    BufferView readView(size_t count = -1);
+
+    std::vector<uint8_t> toVector() const { return std::vector<uint8_t>(mData + mOffset, mData + mOffset + remain()); }
+
+private:
+    const uint8_t* mData = nullptr;
+    size_t mSize = 0;
+    size_t mOffset = 0;
+};
+}
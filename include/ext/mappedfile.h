@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ext {
+// Read-only view of a whole file, mapped where the platform allows it and read into memory otherwise
+class MappedFile {
+public:
+    static constexpr auto Tag = "MappedFile";
+
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+    // The file doesn't exist, which callers treating it as optional don't report as an error
+    bool missing() const { return mMissing; }
+
+    operator bool() const { return mValid; }
+
+private:
+    const char* mData = nullptr;
+    size_t mSize = 0;
+    bool mValid = false;
+    bool mMapped = false;
+    bool mMissing = false;
+    std::vector<char> mBuffer;
+};
+}
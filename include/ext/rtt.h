@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace ext {
+// Round trip estimator deriving a retransmission timeout from the smoothed RTT and its variance,
+// the way TCP does (RFC 6298)
+class Rtt {
+public:
+    Rtt(std::chrono::milliseconds initial, std::chrono::milliseconds min, std::chrono::milliseconds max);
+
+    void sample(std::chrono::microseconds rtt);
+    // Doubles the timeout after a timeout, until the next sample
+    void backoff();
+
+    std::chrono::milliseconds timeout() const { return std::chrono::duration_cast<std::chrono::milliseconds>(mRto); }
+
+    std::chrono::microseconds srtt() const { return mSrtt; }
+    std::chrono::microseconds rttvar() const { return mRttvar; }
+    uint32_t samples() const { return mSamples; }
+
+private:
+    std::chrono::microseconds mMin;
+    std::chrono::microseconds mMax;
+    std::chrono::microseconds mRto;
+    std::chrono::microseconds mSrtt{0};
+    std::chrono::microseconds mRttvar{0};
+    uint32_t mSamples = 0;
+};
+}
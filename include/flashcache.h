@@ -0,0 +1,39 @@
+#pragma once
+#include <memory>
+#include <string>
+
+#include "deviceinfo.h"
+#include "flashfile.h"
+#include "utils/sha256.h"
+
+// Directory of pre-parsed firmware images (.gbfc), named after the SHA-256 of the HEX file and the device's
+// memory map. A hit skips the text parsing and checksum validation entirely.
+//
+// Layout, little endian: "GBFC", version (4), key (32), app info length (4) and bytes, page count (4) and per
+// page its address (4) and valid bitmap (32), the bytes of every page back to back, ciphertext length (4) and
+// bytes, type count (4), then per type: type (1), record count (4), and per record address (4), cmd (1),
+// flags (1), padding (1), size (1) and offset into the ciphertext (4). A hit keeps the file mapped and serves
+// the image and ciphertext straight out of it.
+class FlashCache {
+public:
+    static constexpr auto Tag = "FlashCache";
+
+public:
+    FlashCache(std::string dir);
+
+    // Loads the image from the cache, parsing the HEX file and caching the result on a miss
+    std::unique_ptr<FlashFile> load(const std::string& path, const DeviceInfo& deviceInfo);
+
+private:
+    std::unique_ptr<FlashFile> read(const std::string& path, const utils::SHA256::Digest& key);
+    bool write(const std::string& path, const utils::SHA256::Digest& key, const FlashFile& file);
+
+    static utils::SHA256::Digest key(const char* data, size_t size, const DeviceInfo& deviceInfo);
+
+private:
+    static constexpr uint32_t VERSION = 3;
+    static constexpr size_t PAGE_ENTRY_SIZE = 36;
+    static constexpr size_t RECORD_SIZE = 12;
+
+    std::string mDir;
+};
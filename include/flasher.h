@@ -1,11 +1,23 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <map>
 #include <memory>
+#include <string>
+#include <tuple>
 #include <vector>
 
 #include "appinfo.h"
 #include "deviceinfo.h"
+#include "ext/bufferview.h"
+#include "ext/rtt.h"
+#include "flashfile.h"
+#include "flashstream.h"
 #include "hid.h"
+#include "memoryimage.h"
+#include "probemodel.h"
+#include "session.h"
 
 class Flasher {
 public:
@@ -15,6 +27,21 @@ public:
     static constexpr uint8_t MODE_REGULAR = 0;
     static constexpr uint8_t MODE_BOOT = 1;
 
+    struct Stats {
+        uint32_t requests = 0;
+        uint32_t timeouts = 0;
+        uint32_t retransmits = 0;
+        // Verify round trips spent recovering bytes, the bytes recovered and how many of them were
+        // confirmed from a reference instead of guessed
+        uint32_t probes = 0;
+        uint32_t probed = 0;
+        uint32_t predicted = 0;
+        uint32_t samples = 0;
+        std::chrono::microseconds srtt{0};
+        std::chrono::microseconds rttvar{0};
+        std::chrono::milliseconds timeout{0};
+    };
+
 private:
     struct AddressResult {
         uint32_t address;
@@ -22,7 +49,22 @@ private:
     };
 
 public:
-    Flasher() = default;
+    // Targets the device with the given serial number, or the first one found if empty
+    Flasher(std::string serial = {});
+
+    // Serial numbers of every attached device, in either mode
+    static std::vector<std::string> serials();
+
+    const std::string& serial() const { return mSerial; }
+
+    // Number of write reports allowed in flight before waiting for an ack, 1 is stop-and-wait
+    void setWindow(uint32_t window);
+    // Same for the single byte verifies guessing bytes that can't be read, which change nothing on the
+    // device and are safe to pipeline
+    void setProbeWindow(uint32_t window);
+
+    // Timeouts, retransmits and the round trip estimate of regular commands
+    Stats stats() const;
 
     std::shared_ptr<DeviceInfo> deviceInfo();
     std::shared_ptr<AppInfo> appInfo();
@@ -30,29 +72,93 @@ public:
     bool erase();
     bool flash(const FlashFile& file, const DeviceInfo& info);
     bool setAppInfo(const FlashFile& file, const DeviceInfo& deviceInfo, const AppInfo& appInfo);
+    bool setAppInfo(const DeviceInfo& deviceInfo, const AppInfo& appInfo);
+    // Signs the image after its app info was set, signing an already signed image again is harmless
+    bool sign();
     bool verify(const FlashFile& file, const DeviceInfo& info);
+    // Verifies without reporting mismatches, stopping at the first one
+    bool matches(const FlashFile& file, const DeviceInfo& info);
+
+    // Same as above, writing and verifying records as the stream's parser hands them over. Each
+    // call consumes one pass of the stream, started beforehand.
+    bool flash(FlashStream& stream);
+    bool verify(FlashStream& stream);
 
     bool switchMode(uint8_t mode);
 
-    std::vector<uint8_t> readData(uint32_t address, uint32_t size);
-    bool writeData(uint32_t address, const std::vector<uint8_t>& data, bool encrypted = false);
+    // Releases the open devices so they can be handed to another owner
+    void close();
 
-    bool decode(const FlashFile& file);
+    // Orders the candidates tried when probing, shared so several devices can learn from each other's
+    // bytes. An empty model is created on first use otherwise.
+    void setProbeModel(std::shared_ptr<ProbeModel> model);
+    ProbeModel& probeModel();
+
+    // Receives memory read back in address order, returning false stops the read
+    using Sink = std::function<bool(uint32_t address, const uint8_t* data, size_t size)>;
+
+    // Reads memory in report-sized blocks with CMD_GET_DATA, probing byte by byte with verify only
+    // where the bootloader refuses or doesn't know the command. Bytes present in reference are
+    // confirmed a whole block per verify before anything is probed.
+    bool dump(uint32_t address, uint32_t size, const Sink& sink, const MemoryImage* reference = nullptr);
+    std::vector<uint8_t> readData(uint32_t address, uint32_t size, const MemoryImage* reference = nullptr);
+    bool writeData(uint32_t address, const std::vector<uint8_t>& data, bool encrypted = false);
 
 private:
     bool flashMemory(const FlashFile& file, const DeviceInfo& info, MemoryInfo::Type memType);
-    bool verifyMemory(const FlashFile& file, const DeviceInfo& info, MemoryInfo::Type memType);
+    bool verifyMemory(const FlashFile& file, const DeviceInfo& info, MemoryInfo::Type memType, bool quiet = false);
+
+    bool writeRun(const std::shared_ptr<HID::Device>& dev, const std::vector<const FlashFile::Record*>& run);
+    bool writeRecords(const std::shared_ptr<HID::Device>& dev, const std::vector<const FlashFile::Record*>& run);
+
+    // Replies are views into the reply buffer and stay valid until the next report is received
+    ext::BufferView send(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, ext::BufferView data = {});
+    ext::BufferView sendRecord(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, const FlashFile::Record& f);
+    AddressResult sendResult(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, ext::BufferView data = {});
+    ext::BufferView exchange(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, bool posted);
+
+    bool post(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, ext::BufferView data);
+    bool postRecord(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, const FlashFile::Record& f);
+    bool postRequest(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, size_t len);
+    bool retransmit(const std::shared_ptr<HID::Device>& dev);
+    ext::BufferView receive(const std::shared_ptr<HID::Device>& dev, uint8_t cmd);
+    AddressResult receiveResult(const std::shared_ptr<HID::Device>& dev, uint8_t cmd);
+
+    static AddressResult toResult(ext::BufferView data);
 
-    std::vector<uint8_t> send(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, std::vector<uint8_t> data = {});
-    AddressResult sendResult(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, std::vector<uint8_t> data = {});
+    // Bytes read into dst, 0 without a usable reply or the bootloader's negative result if it refused
+    int32_t getData(const std::shared_ptr<HID::Device>& dev, uint32_t address, uint32_t size, uint8_t* dst);
+    // Guesses up to GET_DATA_SIZE bytes into dst in the model's order with pipelined verifies, learning every
+    // byte found. Returns the bytes recovered, short of size at the first byte no candidate matched.
+    uint32_t probeData(const std::shared_ptr<HID::Device>& dev, uint32_t address, uint32_t size, const MemoryImage* reference, uint8_t* dst);
+    // Verifies predicted bytes together, halving the span where they don't match down to the bytes
+    // that changed, and marks the ones confirmed
+    void confirmData(const std::shared_ptr<HID::Device>& dev, uint32_t address, const uint8_t* predicted, uint32_t size, bool* known);
 
-    std::vector<uint8_t> readSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, std::vector<uint8_t> data = {});
+    std::vector<uint8_t> readSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cmd);
 
     bool writeSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, uint32_t address, const std::vector<uint8_t>& data);
+    static std::vector<std::vector<uint8_t>> segments(uint32_t address, const std::vector<uint8_t>& data);
 
     bool waitMode(uint8_t mode);
 
+    // Erase runs for seconds and committing, signing and setting the app info program flash, which can
+    // take a while too, with no retransmit to fall back on. Every other command answers within a few USB
+    // frames. Each class gets its own estimate.
+    ext::Rtt& rtt(uint8_t cmd);
+    static ext::Rtt commandRtt();
+    static ext::Rtt programRtt();
+    static ext::Rtt eraseRtt();
+    // Commands that program flash and get the programRtt() estimate
+    static bool programs(uint8_t cmd);
+    // Commands that can be sent again when the reply is lost without changing the outcome
+    static bool idempotent(uint8_t cmd);
+
 private:
+    friend class Emulator;
+    friend class Engine;
+    friend class Replay;
+
     static constexpr uint16_t GB_VID = 0x0782U;
     static constexpr uint16_t GB_PID = 0x001BU;
     static constexpr uint16_t GB_BOOT_PID = 0xFFE3U;
@@ -76,4 +182,44 @@ private:
     static constexpr uint8_t CMD_BOOTLOADER = 0xB3U;
 
     static constexpr uint8_t REPORT_BOOT = 0x03U;
+
+private:
+    std::string mSerial;
+    Session mBoot;
+    Session mRegular;
+
+    uint32_t mWindow = 1;
+    uint32_t mProbeWindow = PROBE_WINDOW;
+
+    static constexpr uint32_t MAX_RETRANSMITS = 2;
+    static constexpr uint32_t PROBE_WINDOW = 16;
+    // Bytes of a report left for a command's payload after the report ID and command
+    static constexpr size_t PAYLOAD_SIZE = std::tuple_size<HID::Report>::value - 2;
+    // Bytes a CMD_GET_DATA reply carries after the command, address and result
+    static constexpr size_t GET_DATA_SIZE = std::tuple_size<HID::Report>::value - 10;
+    // Records taken off a stream before they are written, enough to keep a full window busy
+    static constexpr size_t STREAM_BATCH = 64;
+
+    ext::Rtt mRtt;
+    ext::Rtt mProgramRtt;
+    ext::Rtt mEraseRtt;
+    Stats mStats;
+    std::shared_ptr<ProbeModel> mModel;
+
+    // Send times of the requests in flight, replies arrive in order so [mReceived, mPosted) are pending
+    std::vector<std::chrono::steady_clock::time_point> mSent;
+    size_t mPosted = 0;
+    size_t mReceived = 0;
+    bool mRetransmitted = false;
+    bool mTimedOut = false;
+    // The bootloader answered CMD_GET_DATA, from then on it is retransmitted like any other read
+    bool mGetData = false;
+
+    HID::Report mRequest{};
+    HID::Report mReply{};
+    // Reply taken after a retransmit, and how many duplicates of it answering the earlier copies are
+    // still due. A real reply equal to it can only answer an idempotent request, which is sent again.
+    HID::Report mStale{};
+    size_t mStaleLen = 0;
+    uint32_t mStaleReplies = 0;
 };
@@ -3,9 +3,13 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "appinfo.h"
 #include "deviceinfo.h"
+#include "ext/mappedfile.h"
+#include "memoryimage.h"
 
 class FlashFile {
 public:
@@ -21,29 +25,115 @@ public:
 
         uint32_t length() const { return data.size() - 2 - (encrypted ? 2 : 0); }
         std::vector<uint8_t> encoded() const;
+
+        // Writes the address, length and data header into dst, returns the bytes used or 0 if it doesn't fit
+        size_t encode(uint8_t* dst, size_t size) const;
     };
 
-public:
-    FlashFile(const std::string& path, const DeviceInfo& deviceInfo)
-        : FlashFile(std::ifstream(path), deviceInfo)
-    {}
+    // A record held by a FlashFile. Plaintext payloads point into its memory image and ciphertext into
+    // its own arena, both valid for the lifetime of the file.
+    struct Record {
+        uint32_t address;
+        uint8_t cmd;
+        bool encrypted;
+        uint8_t padding;
+        uint8_t size;
+        const uint8_t* data;
+
+        Record() = default;
+        Record(const Command& c);
+
+        uint32_t length() const { return size - 2 - (encrypted ? 2 : 0); }
+
+        // Writes the address, length and data header into dst, returns the bytes used or 0 if it doesn't fit
+        size_t encode(uint8_t* dst, size_t capacity) const;
+    };
+
+    // Walks the records of an in-memory HEX image one at a time, decoding each in place
+    class Reader {
+    public:
+        Reader(const char* begin, const char* end, uint32_t baseAddr, const DeviceInfo& deviceInfo);
+
+        // Returns false at the end of the range or on an invalid record, ok() tells them apart.
+        // Extended address records are consumed, every record returned carries its full address.
+        bool next(MemoryInfo::Type& type, Command& cmd);
+        bool ok() const { return mOk; }
+
+    private:
+        bool fail();
 
+    private:
+        const char* mPos;
+        const char* mEnd;
+        uint32_t mBaseAddr;
+        const DeviceInfo& mDeviceInfo;
+        bool mOk = true;
+    };
+
+public:
+    // Maps the file and decodes records in place
+    FlashFile(const std::string& path, const DeviceInfo& deviceInfo);
     FlashFile(std::ifstream stream, const DeviceInfo& deviceInfo);
 
-    bool has(MemoryInfo::Type type) const { return mCommands.find(type) != mCommands.end(); }
-    const std::map<uint32_t, Command>& cmds(MemoryInfo::Type type) const { return mCommands.at(type); }
+    // Records point into the file's own storage
+    FlashFile(const FlashFile&) = delete;
+    FlashFile& operator=(const FlashFile&) = delete;
+
+    bool has(MemoryInfo::Type type) const { return mRecords.find(type) != mRecords.end(); }
+    // In address order, one per address
+    const std::vector<Record>& cmds(MemoryInfo::Type type) const { return mRecords.at(type); }
+
+    // Plaintext bytes of every record but app info, where a record's trailer meets the start of the
+    // next one the next one's bytes are kept
+    const MemoryImage& image() const { return mImage; }
 
     std::shared_ptr<AppInfo> appInfo() const { return mAppInfo; }
 
     operator bool() const { return mValid; }
 
+    // Cuts runs of contiguous plaintext records into as few records as fit capacity bytes of payload each,
+    // ciphertext keeps its original boundaries. Runs whose bytes don't already lie back to back, as they do
+    // in the image, are copied into scratch, which must outlive the result.
+    static std::vector<Record> coalesce(const std::vector<Record>& records, size_t capacity, std::vector<uint8_t>& scratch);
+
     static uint8_t calculateChecksum(const std::vector<uint8_t>& data, uint32_t size = 0);
 
 protected:
     bool verifyChecksum(const std::vector<uint8_t>& data) const;
 
+private:
+    friend class FlashCache;
+    FlashFile() = default;
+
+    // Files larger than this are parsed in chunks on several threads
+    static constexpr size_t PARALLEL_CHUNK = 256 * 1024;
+
+    using Records = std::map<MemoryInfo::Type, std::vector<Record>>;
+
+    // Payloads are staged back to back in bytes, reserved up front so records can point into it
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        uint32_t baseAddr;
+        std::vector<std::pair<MemoryInfo::Type, Record>> records;
+        std::vector<uint8_t> bytes;
+        bool ok;
+    };
+
+    void load(const char* data, size_t size, const DeviceInfo& deviceInfo);
+    bool parse(const char* data, size_t size, const DeviceInfo& deviceInfo);
+    // Moves the payloads into the image and cipher arena, and repoints the records at them
+    void store(Records records);
+    static bool parseChunk(Chunk& chunk, const DeviceInfo& deviceInfo);
+    // Base address set by the last extended linear address record in the range, or baseAddr if there is none
+    static uint32_t lastBaseAddress(const char* begin, const char* end, uint32_t baseAddr);
+
 private:
     bool mValid = false;
-    std::map<MemoryInfo::Type, std::map<uint32_t, Command>> mCommands;
+    Records mRecords;
+    MemoryImage mImage;
+    std::vector<uint8_t> mCipher;
     std::shared_ptr<AppInfo> mAppInfo;
+    // Cache file the image and the ciphertext of the records point into, when loaded from one
+    std::unique_ptr<ext::MappedFile> mMapping;
 };
@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "deviceinfo.h"
+#include "ext/boundedqueue.h"
+#include "ext/mappedfile.h"
+#include "flashfile.h"
+
+// Parses a HEX file on a producer thread and hands its records over through a bounded queue, so flashing
+// starts before the image is fully parsed and only a queue's worth of records is held at a time
+class FlashStream {
+public:
+    static constexpr auto Tag = "FlashStream";
+
+    using Record = std::pair<MemoryInfo::Type, FlashFile::Command>;
+
+public:
+    FlashStream(const std::string& path, const DeviceInfo& deviceInfo, size_t depth = 256);
+    ~FlashStream();
+
+    operator bool() const { return !!mFile; }
+
+    // Starts a pass over the file, stopping the previous one if it is still running
+    void start();
+
+    // Next record in file order, app info records excluded. Blocks until it is parsed, returns false
+    // at the end of the pass or on a parse error.
+    bool next(MemoryInfo::Type& type, FlashFile::Command& cmd);
+
+    // Valid once next() has returned false: whether the whole file parsed and carried app info
+    bool ok() const { return mOk; }
+    std::shared_ptr<AppInfo> appInfo() const { return mAppInfo; }
+
+    size_t depth() const { return mQueue.capacity(); }
+    size_t maxDepth() const { return mQueue.maxDepth(); }
+    // Times the parser found the queue full, and the consumer found it empty
+    uint32_t producerStalls() const { return mQueue.pushStalls(); }
+    uint32_t consumerStalls() const { return mQueue.popStalls(); }
+    // Time from start() until the first record was handed over
+    std::chrono::microseconds firstRecord() const { return mFirstRecord; }
+
+private:
+    void produce();
+    void stop();
+
+private:
+    ext::MappedFile mFile;
+    const DeviceInfo& mDeviceInfo;
+    ext::BoundedQueue<Record> mQueue;
+    std::thread mProducer;
+
+    std::chrono::steady_clock::time_point mStarted;
+    std::chrono::microseconds mFirstRecord{0};
+    bool mOk = false;
+    std::shared_ptr<AppInfo> mAppInfo;
+};
@@ -1,33 +1,93 @@
 #pragma once
+#include <array>
 #include <cstdint>
 #include <hidapi.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+class Trace;
+
 class HID {
 public:
     static constexpr auto Tag = "HID";
+
+    // Report ID followed by the 64 byte report
+    using Report = std::array<uint8_t, 65>;
+
+    struct Entry {
+        std::string path;
+        std::string serial;
+    };
+
 public:
     class Device {
     public:
         static constexpr auto Tag = "HID::Device";
     public:
         Device(std::string path);
-        ~Device();
+        virtual ~Device();
 
-        bool open();
-        void close();
+        virtual bool open();
+        virtual void close();
+        virtual bool isOpen() const { return mDevice != nullptr; }
 
+        const std::string& path() const { return mPath; }
+
+        // Descriptor that becomes readable when a report is waiting, -1 if the transport can't be polled
+        virtual int fd() const { return -1; }
+
+        // Reads one report into the caller's buffer, returns the number of bytes read, 0 on timeout or < 0 on error
+        int read(Report& report, int timeout = 10000);
         std::vector<uint8_t> read();
+
+        // Sends a fully built report, report[0] being the report ID
+        bool write(const Report& report);
         bool write(const std::vector<uint8_t>& data) { return write(0x00U, data); }
         bool write(uint8_t report, const std::vector<uint8_t>& data);
 
+    protected:
+        // Transport hooks, both return the number of bytes transferred or a negative value on error
+        virtual int readReport(uint8_t* data, size_t size, int timeout);
+        virtual int writeReport(const uint8_t* data, size_t size);
+
     private:
         std::string mPath;
         hid_device* mDevice = nullptr;
     };
 
+    // Source of devices other than the system's HID bus
+    class Bus {
+    public:
+        virtual ~Bus() = default;
+
+        virtual std::vector<Entry> enumerate(uint16_t vid, uint16_t pid, int interfaceNum) = 0;
+        virtual std::shared_ptr<Device> device(const std::string& path) = 0;
+    };
+
+    enum Backend {
+        BACKEND_HIDAPI,
+        BACKEND_HIDRAW,
+    };
+
 public:
-    static std::shared_ptr<HID::Device> find(uint16_t vid, uint16_t pid, int interfaceNum = -1);
+    static std::vector<Entry> enumerate(uint16_t vid, uint16_t pid, int interfaceNum = -1);
+    // An empty serial matches any device
+    static std::shared_ptr<HID::Device> find(uint16_t vid, uint16_t pid, int interfaceNum = -1, const std::string& serial = {});
+    static std::vector<std::shared_ptr<HID::Device>> findAll(uint16_t vid, uint16_t pid, int interfaceNum = -1);
+
+    static void setBus(std::shared_ptr<Bus> bus) { sBus = std::move(bus); }
+    static void setBackend(Backend backend) { sBackend = backend; }
+    // Records every report read or written from now on, nullptr stops recording
+    static void setTrace(std::shared_ptr<Trace> trace) { sTrace = std::move(trace); }
+
+private:
+    static std::shared_ptr<HID::Device> create(const std::string& path);
+
+private:
+    static std::mutex sMutex;
+    static std::shared_ptr<Bus> sBus;
+    static Backend sBackend;
+    static std::shared_ptr<Trace> sTrace;
 };
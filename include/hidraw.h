@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+
+#include "hid.h"
+
+// Talks to /dev/hidrawN directly, bypassing libhidapi's read buffering
+class HIDRaw : public HID::Device {
+public:
+    static constexpr auto Tag = "HIDRaw";
+
+public:
+    HIDRaw(std::string path);
+    ~HIDRaw() override;
+
+    bool open() override;
+    void close() override;
+    bool isOpen() const override { return mFd >= 0; }
+
+    int fd() const override { return mFd; }
+
+protected:
+    int readReport(uint8_t* data, size_t size, int timeout) override;
+    int writeReport(const uint8_t* data, size_t size) override;
+
+private:
+    int mFd = -1;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Registry of hidraw devices fed by kernel and udev uevents, so callers can sleep until a device shows up
+class Hotplug {
+public:
+    static constexpr auto Tag = "Hotplug";
+
+public:
+    static Hotplug& instance();
+
+    ~Hotplug();
+
+    // Starts listening for uevents, returns false if they are unavailable and callers have to poll
+    bool start();
+
+    // Counter bumped by every add event, pass it to wait() to only match devices added after it was read
+    uint64_t generation();
+
+    // Blocks until a matching device is added after the given generation, or the timeout expires
+    bool wait(uint16_t vid, uint16_t pid, int interfaceNum, uint64_t since, std::chrono::milliseconds timeout);
+
+private:
+    struct Entry {
+        uint16_t vid;
+        uint16_t pid;
+        int interfaceNum;
+        uint64_t generation;
+    };
+
+    // Netlink groups of the events sent by the kernel and by udev once it processed them
+    static constexpr uint32_t KERNEL_EVENTS = 1;
+    static constexpr uint32_t UDEV_EVENTS = 2;
+    // "libudev", magic, header size, then the offset and length of the KEY=value pairs
+    static constexpr size_t UDEV_HEADER = 24;
+
+    Hotplug() = default;
+
+    void process();
+    void handle(const char* data, size_t size);
+    bool matches(uint16_t vid, uint16_t pid, int interfaceNum, uint64_t since) const;
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::map<std::string, Entry> mDevices;
+    uint64_t mGeneration = 0;
+
+    bool mStarted = false;
+    bool mAvailable = false;
+    int mSocket = -1;
+    int mStop[2] = {-1, -1};
+    std::unique_ptr<std::thread> mThread;
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Sparse byte image of the 32 bit address space. Bytes live in fixed-size pages carved out of one
+// contiguous arena, found in constant time through a two-level page directory and kept in address
+// order in a flat index, each with a bitmap of the bytes that were written.
+class MemoryImage {
+public:
+    static constexpr auto Tag = "MemoryImage";
+
+public:
+    static constexpr uint32_t PAGE_SHIFT = 8;
+    static constexpr uint32_t PAGE_SIZE = 1U << PAGE_SHIFT;
+
+    using Bitmap = std::array<uint64_t, PAGE_SIZE / 64>;
+
+    struct Page {
+        uint32_t address;
+        // Start of the page's bytes in the arena
+        uint32_t offset;
+        Bitmap valid;
+    };
+
+public:
+    MemoryImage();
+
+    // Later writes replace the bytes of earlier ones
+    void write(uint32_t address, const uint8_t* data, size_t size);
+    // Merges a whole page, only the bytes set in valid are taken from data
+    void write(uint32_t address, const uint8_t* data, const Bitmap& valid);
+
+    // Copies size bytes starting at address, false if any of them was never written
+    bool read(uint32_t address, uint8_t* dst, size_t size) const;
+    bool valid(uint32_t address, size_t size = 1) const;
+
+    // The size bytes at address if they were all written and lie back to back in the arena, which
+    // compact() guarantees for any written range. Invalidated by the next write.
+    const uint8_t* at(uint32_t address, size_t size = 1) const;
+
+    // Lays the arena out in address order, so neighbouring pages are neighbours in memory too
+    void compact();
+
+    // Serves pages, in address order with offsets into arena, straight from arena without copying it.
+    // The arena must outlive the image or its next write, which first copies the bytes in.
+    void map(const uint8_t* arena, size_t size, std::vector<Page> pages);
+
+    // In address order
+    const std::vector<Page>& pages() const { return mPages; }
+    const uint8_t* data(const Page& page) const { return bytes() + page.offset; }
+
+    bool empty() const { return mPages.empty(); }
+    // Bytes held by the arena, index and directory
+    size_t footprint() const;
+
+private:
+    static constexpr uint32_t LEAF_SHIFT = 12;
+    static constexpr uint32_t LEAF_SIZE = 1U << LEAF_SHIFT;
+    static constexpr uint32_t DIRECTORY_SIZE = 1U << (32 - PAGE_SHIFT - LEAF_SHIFT);
+
+    // Index into mPages plus one, zero for pages never written
+    using Leaf = std::array<uint32_t, LEAF_SIZE>;
+
+    const uint8_t* bytes() const { return (mMapped != nullptr) ? mMapped : mArena.data(); }
+    // Copies a mapped arena in before the first write
+    void own();
+
+    const Page* find(uint32_t address) const;
+    Page& page(uint32_t address);
+    void index(uint32_t number, uint32_t slot);
+
+    static void setRange(Bitmap& bits, uint32_t offset, uint32_t count);
+    static bool testRange(const Bitmap& bits, uint32_t offset, uint32_t count);
+
+private:
+    std::vector<uint8_t> mArena;
+    const uint8_t* mMapped = nullptr;
+    size_t mMappedSize = 0;
+    std::vector<Page> mPages;
+    std::vector<std::unique_ptr<Leaf>> mDirectory;
+};
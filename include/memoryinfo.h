@@ -25,6 +25,9 @@ struct MemoryInfo {
     uint32_t length;
 
     MemoryInfo(Type t, uint32_t a, uint32_t l) : type(t), address(a), length(l) {}
+
+    bool operator==(const MemoryInfo& o) const { return type == o.type && address == o.address && length == o.length; }
+    bool operator!=(const MemoryInfo& o) const { return !(*this == o); }
 };
 
 MemoryInfo::Type& operator++(MemoryInfo::Type& t);
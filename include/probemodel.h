@@ -0,0 +1,56 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Byte statistics of firmware plaintext, used to order the candidates tried when a byte can only be
+// recovered by guessing it with verify. Counts are kept globally, per position in the 32 bit instruction
+// word and per preceding byte, and mixed with more weight on a context the more often it was seen.
+//
+// Saved little endian as "GBPM", version (4), then the global, per position and per preceding byte counts (4
+// each)
+class ProbeModel {
+public:
+    static constexpr auto Tag = "ProbeModel";
+
+public:
+    using Order = std::array<uint8_t, 256>;
+
+public:
+    ProbeModel();
+
+    // Counts known plaintext, bytes of one call are taken as consecutive. previous is the byte before address,
+    // nullptr when it isn't known
+    void learn(uint32_t address, const uint8_t* data, size_t size, const uint8_t* previous = nullptr);
+    void learn(uint32_t address, uint8_t value, const uint8_t* previous) { learn(address, &value, 1, previous); }
+
+    // Every byte value, most likely first, previous being the byte before address if known. Without any
+    // statistics this is 0xFF down to 0x00, erased flash first.
+    void order(uint32_t address, const uint8_t* previous, Order& order) const;
+
+    uint64_t samples() const { return mTotal; }
+
+    // A missing file leaves the model empty and succeeds
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+private:
+    using Counts = std::array<uint32_t, 256>;
+
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t POSITIONS = 4;
+    // Samples a context needs before its own statistics outweigh the broader ones
+    static constexpr double CONFIDENCE = 32.0;
+
+    static void add(Counts& counts, uint64_t& total, uint8_t value);
+
+private:
+    Counts mGlobal{};
+    uint64_t mTotal = 0;
+    std::array<Counts, POSITIONS> mPosition{};
+    std::array<uint64_t, POSITIONS> mPositionTotal{};
+    std::vector<Counts> mFollow;
+    std::vector<uint64_t> mFollowTotal;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hid.h"
+#include "trace.h"
+
+// Serves a recorded Trace back through HID::Bus. Every report written is matched to a recorded request and
+// answered with the recorded reply, after the time the device spent on it in the recording
+class Replay : public HID::Bus {
+public:
+    static constexpr auto Tag = "Replay";
+
+public:
+    class Cursor;
+
+    class Device : public HID::Device {
+    public:
+        static constexpr auto Tag = "Replay::Device";
+
+    public:
+        Device(std::string path, std::shared_ptr<Cursor> cursor, uint16_t pid);
+        ~Device() override;
+
+        bool open() override;
+        void close() override;
+        bool isOpen() const override;
+        int fd() const override;
+
+    protected:
+        int readReport(uint8_t* data, size_t size, int timeout) override;
+        int writeReport(const uint8_t* data, size_t size) override;
+
+    private:
+        std::shared_ptr<Cursor> mCursor;
+        uint16_t mPid;
+        uint32_t mGeneration = 0;
+        bool mOpen = false;
+    };
+
+public:
+    Replay(std::vector<Trace::Entry> entries);
+
+    // Divides the recorded delays, 1 keeps the original timing and 0 replies immediately
+    void setSpeed(double speed);
+
+    // Reports written that differ from the recording
+    uint32_t mismatches() const;
+    // Recorded requests never matched
+    uint32_t remaining() const;
+
+    std::vector<HID::Entry> enumerate(uint16_t vid, uint16_t pid, int interfaceNum) override;
+    std::shared_ptr<HID::Device> device(const std::string& path) override;
+
+private:
+    std::shared_ptr<Cursor> mCursor;
+};
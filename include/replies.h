@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Replies a simulated device sends back in order, each readable no sooner than its own time. Guarded by
+// the owner's mutex, which read() waits on
+class Replies {
+public:
+    static constexpr auto Tag = "Replies";
+
+    using Clock = std::chrono::steady_clock;
+
+public:
+    Replies();
+    ~Replies();
+
+    Replies(const Replies&) = delete;
+    Replies& operator=(const Replies&) = delete;
+
+    // Queues a reply, a reply never becomes readable before the ones queued ahead of it
+    void push(Clock::time_point ready, std::vector<uint8_t> data);
+    // Drops every queued reply and fails the reads waiting for one, as a device reset would
+    void reset();
+
+    // Takes the reply at the head of the queue, returns like HID::Device::read
+    int read(std::unique_lock<std::mutex>& lock, uint8_t* data, size_t size, int timeout);
+
+    // Time the last queued reply becomes readable, the epoch when nothing is queued
+    Clock::time_point idle() const { return mQueue.empty() ? Clock::time_point() : mQueue.back().first; }
+    uint32_t generation() const { return mGeneration; }
+    // Expires when the reply at the head of the queue becomes readable, so devices can be polled
+    int fd() const { return mTimer; }
+
+private:
+    void arm();
+
+private:
+    std::deque<std::pair<Clock::time_point, std::vector<uint8_t>>> mQueue;
+    std::condition_variable mCond;
+    uint32_t mGeneration = 1;
+    int mTimer = -1;
+};
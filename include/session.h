@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "hid.h"
+
+class Session {
+public:
+    static constexpr auto Tag = "Session";
+
+public:
+    // An empty serial matches the first device found
+    Session(uint16_t vid, uint16_t pid, int interfaceNum = -1, std::string serial = {});
+
+    // Returns the opened device, enumerating and opening it only if there is no open handle yet
+    std::shared_ptr<HID::Device> device();
+
+    bool present() const;
+    bool isOpen() const { return !!mDevice; }
+
+    // Drops the handle, the next call to device() will enumerate again
+    void invalidate();
+
+private:
+    uint16_t mVid;
+    uint16_t mPid;
+    int mInterface;
+    std::string mSerial;
+
+    std::shared_ptr<HID::Device> mDevice;
+};
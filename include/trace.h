@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Binary log of the reports crossing HID::Device, one fixed size little endian entry per report:
+// monotonic timestamp in ns (8), direction (1), report ID (1) and the 64 report bytes
+class Trace {
+public:
+    static constexpr auto Tag = "Trace";
+
+    enum Direction : uint8_t {
+        DIR_OUT = 0,
+        DIR_IN = 1,
+    };
+
+    struct Entry {
+        uint64_t ns;
+        Direction direction;
+        uint8_t report;
+        std::array<uint8_t, 64> data;
+    };
+
+    static constexpr size_t ENTRY_SIZE = 8 + 1 + 1 + 64;
+
+public:
+    ~Trace();
+
+    bool open(const std::string& path);
+    void close();
+
+    // data[0] is the report ID for outbound reports, inbound reports carry no ID
+    void append(Direction direction, const uint8_t* data, size_t size);
+
+    static std::vector<Entry> load(const std::string& path);
+
+private:
+    std::mutex mMutex;
+    FILE* mFile = nullptr;
+};
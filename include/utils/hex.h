@@ -14,6 +14,7 @@ public:
     static std::vector<uint8_t> fromString(uint16_t p);
 
     static std::string toString(const std::vector<uint8_t>& data);
+    static std::string toString(const uint8_t* data, size_t size);
     static std::string toString(uint8_t data);
     static std::string toString(uint16_t data);
 
@@ -21,6 +22,13 @@ public:
 
     static std::string toASCII(const std::vector<uint8_t>& data);
 
+    // Decodes count bytes from the 2 * count hex digits at src, fails on anything that isn't a hex digit
+    static bool decode(const char* src, size_t count, uint8_t* dst) { uint8_t sum = 0; return decode(src, count, dst, sum); }
+    // Same, adding the decoded bytes to sum as it goes for checksumming
+    static bool decode(const char* src, size_t count, uint8_t* dst, uint8_t& sum);
+    // Writes 2 * count upper case hex digits to dst
+    static void encode(const uint8_t* src, size_t count, char* dst);
+
     static uint8_t toNibble(char c) { bool error; return toNibble(c, error); }
     static uint8_t toNibble(char c, bool& error) ;
 };
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+class SHA256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+public:
+    SHA256();
+
+    SHA256& update(const void* data, size_t size);
+    SHA256& update(const std::vector<uint8_t>& data) { return update(data.data(), data.size()); }
+    Digest digest();
+
+    static Digest hash(const void* data, size_t size) { return SHA256().update(data, size).digest(); }
+
+private:
+    void transform(const uint8_t* data, size_t blocks);
+
+private:
+    std::array<uint32_t, 8> mState;
+    std::array<uint8_t, 64> mBuffer;
+    uint64_t mLength = 0;
+    size_t mFill = 0;
+};
+}
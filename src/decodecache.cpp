@@ -0,0 +1,210 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "decodecache.h"
+#include "ext/bufferstream.h"
+#include "ext/mappedfile.h"
+#include "logger.h"
+
+namespace {
+const uint8_t MAGIC[4] = {'G', 'B', 'D', 'C'};
+
+#if defined(_WIN32)
+int openFile(const char* path, int flags) { return _open(path, flags | _O_BINARY, _S_IREAD | _S_IWRITE); }
+int writeFile(int fd, const void* data, size_t size) { return _write(fd, data, static_cast<unsigned>(size)); }
+int syncFile(int fd) { return _commit(fd); }
+int closeFile(int fd) { return _close(fd); }
+#else
+int openFile(const char* path, int flags) { return ::open(path, flags, 0644); }
+ssize_t writeFile(int fd, const void* data, size_t size) { return ::write(fd, data, size); }
+int syncFile(int fd) { return fsync(fd); }
+int closeFile(int fd) { return close(fd); }
+#endif
+}
+
+DecodeCache::DecodeCache(std::string path)
+    : mPath(std::move(path))
+{}
+
+DecodeCache::~DecodeCache()
+{
+    if (mFd >= 0) {
+        sync();
+        closeFile(mFd);
+    }
+}
+
+bool DecodeCache::open()
+{
+    if (!load()) {
+        return false;
+    }
+
+    // Whoever creates the file writes its header, everyone else only appends to it
+    mFd = openFile(mPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_EXCL);
+    bool created = mFd >= 0;
+    if (!created && errno == EEXIST) {
+        mFd = openFile(mPath.c_str(), O_WRONLY | O_APPEND);
+    }
+
+    if (mFd < 0) {
+        Logger::error<DecodeCache>("open") << "Could not open" << mPath << ":" << strerror(errno);
+        return false;
+    }
+
+    if (created) {
+        ext::BufferStream header;
+        header.append(std::vector<uint8_t>(MAGIC, MAGIC + sizeof(MAGIC)));
+        header.appendDword(VERSION);
+        const auto data = header.data();
+        if (writeFile(mFd, data.data(), data.size()) != static_cast<int>(data.size())) {
+            Logger::error<DecodeCache>("open") << "Could not write" << mPath;
+            return false;
+        }
+    }
+
+    mSinceSync.reset();
+    return true;
+}
+
+DecodeCache::Key DecodeCache::key(const FlashFile::Record& record)
+{
+    return utils::SHA256::hash(record.data, record.size);
+}
+
+const std::vector<uint8_t>* DecodeCache::find(uint32_t address, const Key& key) const
+{
+    auto it = mRecords.find({address, key});
+    return (it == mRecords.end()) ? nullptr : &it->second;
+}
+
+bool DecodeCache::add(uint32_t address, const Key& key, const uint8_t* data, size_t size)
+{
+    if (mFd < 0 || size > 0xFFU) {
+        return false;
+    }
+
+    uint8_t record[4 + sizeof(Key) + 1 + 0xFFU + CHECK_SIZE];
+    size_t len = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        record[len++] = static_cast<uint8_t>(address >> (8U * i));
+    }
+
+    memcpy(record + len, key.data(), key.size());
+    len += key.size();
+    record[len++] = static_cast<uint8_t>(size);
+    memcpy(record + len, data, size);
+    len += size;
+    const auto check = utils::SHA256::hash(record, len);
+    memcpy(record + len, check.data(), CHECK_SIZE);
+    len += CHECK_SIZE;
+
+    // One unbuffered append, so a decode sharing the file can't land in the middle of the record
+    if (writeFile(mFd, record, len) != static_cast<int>(len)) {
+        Logger::error<DecodeCache>("add") << "Could not write" << mPath;
+        return false;
+    }
+
+    mRecords[{address, key}].assign(data, data + size);
+    if (++mUnsynced >= SYNC_RECORDS || mSinceSync.elapsedMs() >= SYNC_INTERVAL) {
+        return sync();
+    }
+
+    return true;
+}
+
+bool DecodeCache::sync()
+{
+    if (mFd < 0 || mUnsynced == 0) {
+        return true;
+    }
+
+    bool ok = syncFile(mFd) == 0;
+    if (!ok) {
+        Logger::error<DecodeCache>("sync") << "Could not sync" << mPath << ":" << strerror(errno);
+    }
+
+    Logger::verbose<DecodeCache>("sync") << "Synced" << mUnsynced << "records";
+    mUnsynced = 0;
+    mSinceSync.reset();
+    return ok;
+}
+
+bool DecodeCache::load()
+{
+    ext::MappedFile file(mPath);
+    if (file.missing()) {
+        return true;
+    }
+
+    if (!file) {
+        return false;
+    }
+
+    // Created by a decode that hasn't written the header yet
+    if (file.size() == 0) {
+        return true;
+    }
+
+    ext::BufferView view(reinterpret_cast<const uint8_t*>(file.data()), file.size());
+    auto magic = view.readView(sizeof(MAGIC));
+    auto version = view.readUInt32();
+
+    if (magic.size() != sizeof(MAGIC) || memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0 || version != VERSION) {
+        Logger::error<DecodeCache>("load") << mPath << "is not a decode cache";
+        return false;
+    }
+
+    // A record torn by a crash may be followed by whole ones appended later, resynchronize on the next
+    // offset that holds a record with a matching check
+    size_t skipped = 0;
+    while (!view.eof()) {
+        uint32_t address;
+        Key key;
+        ext::BufferView data;
+        auto len = parse(ext::BufferView(view.data() + view.offset(), view.remain()), address, key, data);
+        if (len == 0) {
+            view.skip(1);
+            ++skipped;
+            continue;
+        }
+
+        mRecords[{address, key}].assign(data.data(), data.data() + data.size());
+        view.skip(len);
+    }
+
+    Logger::verbose<DecodeCache>("load") << "Loaded" << mRecords.size() << "records from" << mPath;
+    if (skipped > 0) {
+        Logger::warning<DecodeCache>("load") << "Skipped" << skipped << "bytes of torn records in" << mPath;
+    }
+
+    return true;
+}
+
+size_t DecodeCache::parse(ext::BufferView view, uint32_t& address, Key& key, ext::BufferView& data)
+{
+    address = view.readUInt32();
+    auto k = view.readView(sizeof(Key));
+    auto size = view.readUInt8();
+    data = view.readView(size);
+    auto stored = view.readView(CHECK_SIZE);
+    if (stored.size() != CHECK_SIZE || data.size() != size) {
+        return 0;
+    }
+
+    const auto check = utils::SHA256::hash(view.data(), stored.data() - view.data());
+    if (memcmp(check.data(), stored.data(), CHECK_SIZE) != 0) {
+        return 0;
+    }
+
+    std::copy(k.data(), k.data() + k.size(), key.begin());
+    return view.offset();
+}
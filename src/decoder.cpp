@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <thread>
+
+#include "decoder.h"
+#include "logger.h"
+
+Decoder::Decoder(const FlashFile& file, ProbeModel& model, const MemoryImage* reference, DecodeCache* cache)
+    : mFile(file)
+    , mModel(model)
+    , mReference(reference)
+    , mCache(cache)
+{
+    for (const auto& p: file.cmds(MemoryInfo::APPLICATION)) {
+        if (p.encrypted) {
+            mRecords.emplace_back(&p);
+        }
+    }
+}
+
+bool Decoder::run(const std::vector<Flasher*>& flashers, const Flasher::Sink& sink)
+{
+    if (flashers.empty()) {
+        return false;
+    }
+
+    // The plaintext records of the same image are the closest match to what the ciphered ones hide
+    for (const auto& p: mFile.cmds(MemoryInfo::APPLICATION)) {
+        if (!p.encrypted) {
+            mModel.learn(p.address, p.data, p.length());
+        }
+    }
+
+    mRetry.clear();
+    mAttempts.assign(mRecords.size(), 0);
+    mResults.assign(mRecords.size(), {});
+    mDone.assign(mRecords.size(), false);
+    mWritten = 0;
+    mFailed = false;
+
+    mKeys.clear();
+    mPending.clear();
+    for (size_t i = 0; i < mRecords.size(); ++i) {
+        const std::vector<uint8_t>* cached = nullptr;
+        if (mCache != nullptr) {
+            mKeys.emplace_back(DecodeCache::key(*mRecords[i]));
+            cached = mCache->find(mRecords[i]->address, mKeys.back());
+        }
+
+        if (cached != nullptr && cached->size() == mRecords[i]->length()) {
+            mResults[i] = *cached;
+            mDone[i] = true;
+        } else {
+            mPending.push_back(i);
+        }
+    }
+
+    if (mCache != nullptr) {
+        Logger::info<Decoder>("run") << (mRecords.size() - mPending.size()) << "of" << mRecords.size() << "records found in the cache";
+    }
+
+    const size_t workers = flashers.size();
+    mRanges.clear();
+    for (size_t i = 0; i < workers; ++i) {
+        mRanges.push_back({mPending.size() * i / workers, mPending.size() * (i + 1) / workers});
+    }
+
+    mDecoded.assign(workers, 0);
+    mStolen.assign(workers, 0);
+    mInFlight = 0;
+    mWriting = false;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        write(lock, sink);
+    }
+
+    // Each device probes with its own copy, the model's context is the last byte it learned. Taken before
+    // any worker runs, the shared model learns what is written out from then on.
+    for (auto* f: flashers) {
+        f->setProbeModel(std::make_shared<ProbeModel>(mModel));
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back([this, i, &flashers, &sink]() { work(i, *flashers[i], sink); });
+    }
+
+    for (auto& t: threads) {
+        t.join();
+    }
+
+    if (mCache != nullptr) {
+        mCache->sync();
+    }
+
+    for (size_t i = 0; i < workers && workers > 1; ++i) {
+        Logger::info<Decoder>("run") << flashers[i]->serial() << "decoded" << mDecoded[i] << "records," << mStolen[i] << "of them stolen";
+    }
+
+    if (mFailed || mWritten != mRecords.size()) {
+        Logger::error<Decoder>("run") << "Decoded" << mWritten << "of" << mRecords.size() << "records";
+        return false;
+    }
+
+    return true;
+}
+
+void Decoder::work(size_t worker, Flasher& flasher, const Flasher::Sink& sink)
+{
+    size_t index;
+    while (next(worker, index)) {
+        const auto& p = *mRecords[index];
+        auto d = flasher.readData(p.address, p.length(), mReference);
+        if (d.size() != p.length()) {
+            Logger::error<Decoder>("work") ("%s failed reading address %08X, leaving its records to the others", flasher.serial().c_str(),
+                p.address);
+            fail(worker, index);
+            return;
+        }
+
+        complete(index, std::move(d), sink);
+    }
+}
+
+bool Decoder::next(size_t worker, size_t& index)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto& own = mRanges[worker];
+    while (!mFailed && own.begin == own.end && mRetry.empty()) {
+        // Records are contiguous within a share so probes keep the previous byte as context, stealing the
+        // upper half of the biggest share keeps both halves that way
+        auto victim = std::max_element(mRanges.begin(), mRanges.end(), [](const Range& a, const Range& b) {
+            return (a.end - a.begin) < (b.end - b.begin);
+        });
+
+        const size_t left = victim->end - victim->begin;
+        if (left > 0) {
+            own = {victim->end - (left + 1) / 2, victim->end};
+            victim->end = own.begin;
+            mStolen[worker] += static_cast<uint32_t>(own.end - own.begin);
+            break;
+        }
+
+        // Nothing left to take, but a record still being decoded elsewhere may come back for a retry
+        if (mInFlight == 0) {
+            return false;
+        }
+
+        mChanged.wait(lock);
+    }
+
+    if (mFailed) {
+        return false;
+    }
+
+    if (own.begin != own.end) {
+        index = mPending[own.begin++];
+    } else {
+        index = mRetry.back();
+        mRetry.pop_back();
+    }
+
+    ++mAttempts[index];
+    ++mDecoded[worker];
+    ++mInFlight;
+    return true;
+}
+
+void Decoder::complete(size_t index, std::vector<uint8_t> data, const Flasher::Sink& sink)
+{
+    // A record that could not be cached is only decoded again next time
+    if (mCache != nullptr) {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        mCache->add(mRecords[index]->address, mKeys[index], data.data(), data.size());
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mResults[index] = std::move(data);
+    mDone[index] = true;
+    --mInFlight;
+    mChanged.notify_all();
+    write(lock, sink);
+}
+
+void Decoder::write(std::unique_lock<std::mutex>& lock, const Flasher::Sink& sink)
+{
+    // One thread writes at a time, the others leave their records to it and go back to decoding. Records
+    // done up to the first one still missing are taken out under the lock and written without it.
+    if (mWriting) {
+        return;
+    }
+
+    mWriting = true;
+    std::vector<std::pair<const FlashFile::Record*, std::vector<uint8_t>>> batch;
+    while (!mFailed && mWritten < mRecords.size() && mDone[mWritten]) {
+        for (; mWritten < mRecords.size() && mDone[mWritten]; ++mWritten) {
+            batch.emplace_back(mRecords[mWritten], std::move(mResults[mWritten]));
+        }
+
+        lock.unlock();
+        bool ok = true;
+        for (const auto& r: batch) {
+            mModel.learn(r.first->address, r.second.data(), r.second.size());
+            if (!sink(r.first->address, r.second.data(), r.second.size())) {
+                ok = false;
+                break;
+            }
+        }
+
+        batch.clear();
+        lock.lock();
+        if (!ok) {
+            mFailed = true;
+            mChanged.notify_all();
+        }
+    }
+
+    mWriting = false;
+}
+
+void Decoder::fail(size_t worker, size_t index)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    --mDecoded[worker];
+    --mInFlight;
+    if (mAttempts[index] > 1) {
+        mFailed = true;
+    } else {
+        mRetry.push_back(index);
+    }
+
+    mChanged.notify_all();
+}
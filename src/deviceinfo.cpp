@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "deviceinfo.h"
 #include "ext/bufferstream.h"
 #include "flashfile.h"
@@ -9,7 +11,7 @@ DeviceInfo::DeviceInfo(const std::vector<uint8_t>& data)
     ext::BufferStream stream(data);
     mFieldSize = stream.readUInt8();
     mBytesPerAddress = stream.readUInt8();
-    for (uint32_t i = 0; i < 6; ++i) {
+    for (uint32_t i = 0; i < MAX_BLOCKS; ++i) {
         MemoryInfo::Type type = static_cast<MemoryInfo::Type>(stream.readUInt8());
         if (type == MemoryInfo::END) {
             break;
@@ -20,6 +22,55 @@ DeviceInfo::DeviceInfo(const std::vector<uint8_t>& data)
         Logger::verbose<DeviceInfo>("DeviceInfo")("Memory type %02X, address %08X, length %08X", type, addr, len);
         mMemInfo.emplace_back(type, addr, len);
     }
+
+    buildIntervals();
+}
+
+void DeviceInfo::buildIntervals()
+{
+    // Every block starts and ends on a boundary, between two boundaries the covering blocks don't change
+    std::vector<uint64_t> bounds;
+    for (uint8_t i = 0; i < mMemInfo.size(); ++i) {
+        bounds.push_back(mMemInfo[i].address);
+        bounds.push_back(end(i));
+    }
+
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    for (size_t b = 0; b + 1 < bounds.size(); ++b) {
+        Interval iv{bounds[b], bounds[b + 1], 0, {}};
+        for (uint8_t i = 0; i < mMemInfo.size(); ++i) {
+            if (mMemInfo[i].address <= iv.start && end(i) >= iv.end) {
+                iv.blocks[iv.count++] = i;
+            }
+        }
+
+        if (iv.count == 0) {
+            continue;
+        }
+
+        // Shortest first, of equal blocks the last one listed wins as it always has
+        std::sort(iv.blocks.begin(), iv.blocks.begin() + iv.count, [this](uint8_t a, uint8_t b) {
+            return (mMemInfo[a].length != mMemInfo[b].length) ? mMemInfo[a].length < mMemInfo[b].length : a > b;
+        });
+
+        if (!mIntervals.empty() && mIntervals.back().end == iv.start && mIntervals.back().count == iv.count
+            && std::equal(iv.blocks.begin(), iv.blocks.begin() + iv.count, mIntervals.back().blocks.begin())) {
+            mIntervals.back().end = iv.end;
+        } else {
+            mIntervals.push_back(iv);
+        }
+    }
+}
+
+const DeviceInfo::Interval* DeviceInfo::interval(uint32_t addr) const
+{
+    auto it = std::upper_bound(mIntervals.begin(), mIntervals.end(), addr, [](uint32_t a, const Interval& iv) { return a < iv.start; });
+    if (it == mIntervals.begin() || addr >= (--it)->end) {
+        return nullptr;
+    }
+
+    return &*it;
 }
 
 uint32_t DeviceInfo::address(MemoryInfo::Type type) const
@@ -35,15 +86,61 @@ uint32_t DeviceInfo::address(MemoryInfo::Type type) const
 
 MemoryInfo::Type DeviceInfo::memoryType(uint32_t addr, uint32_t size) const
 {
-    MemoryInfo::Type ret = MemoryInfo::NONE;
-    uint32_t maxLen = 0;
-    for (const auto& p: mMemInfo) {
-        // Find the shortest matching block
-        if (addr >= p.address && addr + size <= p.address + p.length && (maxLen == 0 || p.length <= maxLen)) {
-            ret = p.type;
-            maxLen = p.length;
+    const auto* iv = interval(addr);
+    if (iv == nullptr) {
+        return MemoryInfo::NONE;
+    }
+
+    // Every block holding the range holds its start, so the first one long enough is the shortest
+    for (uint8_t i = 0; i < iv->count; ++i) {
+        if (static_cast<uint64_t>(addr) + size <= end(iv->blocks[i])) {
+            return mMemInfo[iv->blocks[i]].type;
+        }
+    }
+
+    return MemoryInfo::NONE;
+}
+
+bool DeviceInfo::validateFlashFile(const FlashFile& file) const
+{
+    auto appInfo = file.appInfo();
+    uint32_t appInfoAddress = address(MemoryInfo::APPINFO);
+    if (!!appInfo && appInfoAddress != 0xFFFFFFFFU) {
+        auto* iv = interval(appInfoAddress);
+        bool fits = false;
+        for (uint8_t i = 0; iv != nullptr && i < iv->count; ++i) {
+            fits = fits || (mMemInfo[iv->blocks[i]].type == MemoryInfo::APPINFO && appInfoAddress + static_cast<uint64_t>(appInfo->data().size()) <= end(iv->blocks[i]));
+        }
+
+        if (!fits) {
+            Logger::error<DeviceInfo>("validateFlashFile") ("App info of %u bytes doesn't fit its block at %08X", static_cast<uint32_t>(appInfo->data().size()), appInfoAddress);
+            return false;
         }
     }
 
-    return ret;
+    // Records and intervals are both in address order, so each type is checked in one pass over both
+    return MemoryInfo::ALL([&](auto t) {
+        if (t == MemoryInfo::APPINFO || !file.has(t)) {
+            return true;
+        }
+
+        auto iv = mIntervals.begin();
+        for (const auto& r: file.cmds(t)) {
+            while (iv != mIntervals.end() && iv->end <= r.address) {
+                ++iv;
+            }
+
+            bool inside = false;
+            for (uint8_t i = 0; iv != mIntervals.end() && iv->start <= r.address && i < iv->count && !inside; ++i) {
+                inside = mMemInfo[iv->blocks[i]].type == t && static_cast<uint64_t>(r.address) + r.size <= end(iv->blocks[i]);
+            }
+
+            if (!inside) {
+                Logger::error<DeviceInfo>("validateFlashFile") ("Record at %08X (%u bytes) is outside every block of type %d", r.address, r.size, t);
+                return false;
+            }
+        }
+
+        return true;
+    });
 }
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "dumpwriter.h"
+#include "logger.h"
+#include "utils/hex.h"
+
+DumpWriter::DumpWriter(const std::string& path, Format format)
+    : mFile((path == "-") ? stdout : fopen(path.c_str(), (format == FORMAT_HEX) ? "w" : "wb"))
+    , mFormat(format)
+{
+    if (mFile == nullptr) {
+        Logger::error<DumpWriter>("DumpWriter") << "Could not create" << path << ":" << strerror(errno);
+        return;
+    }
+
+    mBuffer.reserve(BUFFER_SIZE);
+    mLine.reserve(LINE_SIZE);
+}
+
+DumpWriter::~DumpWriter()
+{
+    if (mFile != nullptr) {
+        close();
+    }
+}
+
+DumpWriter::Format DumpWriter::formatOf(const std::string& path)
+{
+    auto dot = path.rfind('.');
+    auto ext = (dot == std::string::npos) ? std::string() : path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return (path == "-" || ext == "hex" || ext == "ihex") ? FORMAT_HEX : FORMAT_BIN;
+}
+
+bool DumpWriter::write(uint32_t address, const uint8_t* data, size_t size)
+{
+    if (mFile == nullptr || (mStarted && address < mNext)) {
+        return false;
+    }
+
+    if (mFormat == FORMAT_BIN) {
+        if (mStarted) {
+            mBuffer.append(address - mNext, static_cast<char>(0xFFU));
+        }
+
+        mBuffer.append(reinterpret_cast<const char*>(data), size);
+    } else {
+        while (size > 0) {
+            if (!mLine.empty() && address != mLineAddress + mLine.size()) {
+                writeLine();
+            }
+
+            if (mLine.empty()) {
+                mLineAddress = address;
+            }
+
+            // Lines end on 16 byte boundaries like in the files they were flashed from
+            size_t n = std::min(size, LINE_SIZE - (address % LINE_SIZE));
+            mLine.insert(mLine.end(), data, data + n);
+            address += n;
+            data += n;
+            size -= n;
+            if (address % LINE_SIZE == 0) {
+                writeLine();
+            }
+        }
+    }
+
+    mStarted = true;
+    mNext = address + ((mFormat == FORMAT_BIN) ? size : 0);
+    return (mBuffer.size() < BUFFER_SIZE) || flush();
+}
+
+bool DumpWriter::close()
+{
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    if (mFormat == FORMAT_HEX) {
+        writeLine();
+        record(0x01U, 0, nullptr, 0);
+    }
+
+    bool ok = flush();
+    ok = ((mFile == stdout) ? (fflush(mFile) == 0) : (fclose(mFile) == 0)) && ok;
+    mFile = nullptr;
+    if (!ok) {
+        Logger::error<DumpWriter>("close") << "Failed writing dump";
+    }
+
+    return ok;
+}
+
+void DumpWriter::writeLine()
+{
+    if (mLine.empty()) {
+        return;
+    }
+
+    uint32_t base = mLineAddress & 0xFFFF0000U;
+    if (base != mBase) {
+        const uint8_t ext[] = {static_cast<uint8_t>(base >> 24U), static_cast<uint8_t>(base >> 16U)};
+        record(0x04U, 0, ext, sizeof(ext));
+        mBase = base;
+    }
+
+    record(0x00U, static_cast<uint16_t>(mLineAddress), mLine.data(), mLine.size());
+    mLine.clear();
+}
+
+void DumpWriter::record(uint8_t type, uint16_t offset, const uint8_t* data, size_t size)
+{
+    // Length, address, type, data and a checksum bringing the sum of all bytes to zero
+    const uint8_t header[] = {static_cast<uint8_t>(size), static_cast<uint8_t>(offset >> 8U), static_cast<uint8_t>(offset), type};
+    uint8_t sum = 0;
+    for (auto b: header) {
+        sum += b;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        sum += data[i];
+    }
+
+    const uint8_t check = static_cast<uint8_t>(~sum + 1U);
+    char line[1 + 2 * (sizeof(header) + LINE_SIZE + 1) + 1];
+    line[0] = ':';
+    utils::Hex::encode(header, sizeof(header), line + 1);
+    utils::Hex::encode(data, size, line + 1 + 2 * sizeof(header));
+    utils::Hex::encode(&check, 1, line + 1 + 2 * (sizeof(header) + size));
+    line[1 + 2 * (sizeof(header) + size + 1)] = '\n';
+    mBuffer.append(line, 2 + 2 * (sizeof(header) + size + 1));
+}
+
+bool DumpWriter::flush()
+{
+    if (!mBuffer.empty() && fwrite(mBuffer.data(), 1, mBuffer.size(), mFile) != mBuffer.size()) {
+        mOk = false;
+    }
+
+    mBuffer.clear();
+    return mOk;
+}
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "emulator.h"
+#include "ext/allocations.h"
+#include "ext/bufferstream.h"
+#include "flasher.h"
+#include "logger.h"
+#include "replies.h"
+
+class Emulator::Unit {
+public:
+    static constexpr auto Tag = "Emulator::Unit";
+
+public:
+    Unit(uint32_t index, const std::vector<MemoryInfo>& memInfo)
+        : index(index)
+        , memInfo(memInfo)
+    {
+        for (const auto& m: memInfo) {
+            blocks.emplace_back(m.length, 0xFFU);
+            sealed.emplace_back(m.length, false);
+        }
+    }
+
+    void handle(uint16_t pid, const uint8_t* data, size_t size);
+    int read(uint8_t* data, size_t size, int timeout);
+
+private:
+    void handleBoot(const std::vector<uint8_t>& report);
+    void reply(ext::BufferStream& stream);
+    void erase(MemoryInfo::Type type);
+    uint8_t* at(uint32_t address, uint32_t size);
+    bool readable(uint32_t address, uint32_t size) const;
+    void seal(uint32_t address);
+
+public:
+    uint32_t index;
+    std::vector<MemoryInfo> memInfo;
+    std::chrono::microseconds latency{0};
+
+    std::mutex mutex;
+    uint8_t mode = Flasher::MODE_REGULAR;
+    Replies replies;
+
+private:
+    std::vector<std::vector<uint8_t>> blocks;
+    // Bytes programmed with ciphered writes, which CMD_GET_DATA doesn't give away
+    std::vector<std::vector<bool>> sealed;
+
+    uint16_t appInfoSize = 0;
+    uint8_t appInfoIndex = 0;
+};
+
+void Emulator::Unit::handle(uint16_t pid, const uint8_t* data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (size < 2) {
+        return;
+    }
+
+    if (mode == Flasher::MODE_REGULAR) {
+        if (pid == Flasher::GB_PID && data[0] == Flasher::REPORT_BOOT && data[1] == Flasher::CMD_BOOTLOADER) {
+            Logger::verbose<Unit>("handle") << "Unit" << index << "entering boot mode";
+            mode = Flasher::MODE_BOOT;
+            replies.reset();
+        }
+
+        return;
+    }
+
+    handleBoot(std::vector<uint8_t>(data + 1, data + size));
+}
+
+void Emulator::Unit::handleBoot(const std::vector<uint8_t>& report)
+{
+    ext::BufferStream in(report);
+    ext::BufferStream out;
+    auto cmd = in.readUInt8();
+    out.append(cmd);
+
+    switch (cmd) {
+        case Flasher::CMD_DEVICEINFO: {
+            out.append(static_cast<uint8_t>(4U));
+            out.append(static_cast<uint8_t>(1U));
+            for (const auto& m: memInfo) {
+                out.append(static_cast<uint8_t>(m.type));
+                out.appendDword(m.address);
+                out.appendDword(m.length);
+            }
+
+            out.append(static_cast<uint8_t>(MemoryInfo::END));
+            break;
+        }
+        case Flasher::CMD_ERASE: {
+            erase(MemoryInfo::APPLICATION);
+            erase(MemoryInfo::APPINFO);
+            appInfoSize = 0;
+            break;
+        }
+        case Flasher::CMD_WRITE:
+        case Flasher::CMD_WRITE_CIPHERED:
+        case Flasher::CMD_VERIFY:
+        case Flasher::CMD_VERIFY_CIPHERED: {
+            auto address = in.readUInt32();
+            auto len = in.readUInt32();
+            auto* mem = (report.size() >= 9 && len <= report.size() - 9) ? at(address, len) : nullptr;
+            int32_t result = (mem != nullptr) ? 0 : -2;
+            for (uint32_t i = 0; i < len && mem != nullptr; ++i) {
+                auto d = in.readUInt8();
+                if (cmd == Flasher::CMD_WRITE_CIPHERED || cmd == Flasher::CMD_VERIFY_CIPHERED) {
+                    d ^= cipher(address + i);
+                }
+
+                if (cmd == Flasher::CMD_WRITE || cmd == Flasher::CMD_WRITE_CIPHERED) {
+                    // Programming can only clear bits
+                    mem[i] &= d;
+                    if (cmd == Flasher::CMD_WRITE_CIPHERED) {
+                        seal(address + i);
+                    }
+                } else if (mem[i] != d) {
+                    result = -1;
+                    break;
+                }
+            }
+
+            out.appendDword(address);
+            out.appendDword(static_cast<uint32_t>(result));
+            break;
+        }
+        case Flasher::CMD_GET_DATA: {
+            auto address = in.readUInt32();
+            auto len = in.readUInt32();
+            const auto* mem = (len <= Flasher::GET_DATA_SIZE) ? at(address, len) : nullptr;
+            int32_t result = (mem == nullptr) ? -2 : !readable(address, len) ? -3 : 0;
+            out.appendDword(address);
+            out.appendDword(static_cast<uint32_t>(result));
+            for (uint32_t i = 0; i < len && result == 0; ++i) {
+                out.append(mem[i]);
+            }
+
+            break;
+        }
+        case Flasher::CMD_WRITE_COMPLETE:
+        case Flasher::CMD_SIGN: {
+            out.appendDword(0U);
+            out.appendDword(0U);
+            break;
+        }
+        case Flasher::CMD_SET_APPINFO: {
+            auto address = in.readUInt32();
+            auto total = in.readUInt16();
+            auto blkSize = in.readUInt8();
+            auto blkIndex = in.readUInt8();
+            uint32_t start = blkIndex * 54U;
+            uint32_t len = std::min<uint32_t>(std::min<uint32_t>(blkSize, 54U), (total > start) ? total - start : 0U);
+            auto* mem = at(address + start, len);
+            if (mem != nullptr) {
+                for (uint32_t i = 0; i < len; ++i) {
+                    mem[i] = in.readUInt8();
+                }
+
+                appInfoSize = total;
+            }
+
+            out.appendDword(address);
+            out.appendDword(mem != nullptr ? 0U : 0xFFFFFFFFU);
+            break;
+        }
+        case Flasher::CMD_GET_APPINFO: {
+            uint32_t address = 0xFFFFFFFFU;
+            for (const auto& m: memInfo) {
+                if (m.type == MemoryInfo::APPINFO) {
+                    address = m.address;
+                }
+            }
+
+            if (appInfoSize == 0 || address == 0xFFFFFFFFU) {
+                out.appendDword(0xFFFFFFFFU);
+                break;
+            }
+
+            uint32_t start = appInfoIndex * 54U;
+            uint8_t len = std::min<uint32_t>(54U, appInfoSize - start);
+            const auto* mem = at(address + start, len);
+            out.appendDword(address);
+            out.appendWord(appInfoSize);
+            out.append(len);
+            out.append(appInfoIndex);
+            for (uint32_t i = 0; i < len; ++i) {
+                out.append(mem[i]);
+            }
+
+            appInfoIndex = (start + len >= appInfoSize) ? 0 : appInfoIndex + 1;
+            break;
+        }
+        case Flasher::CMD_RESET: {
+            Logger::verbose<Unit>("handle") << "Unit" << index << "resetting to regular mode";
+            mode = Flasher::MODE_REGULAR;
+            replies.reset();
+            return;
+        }
+        default: {
+            out.appendDword(0xFFFFFFFFU);
+            out.appendDword(0xFFFFFFFFU);
+            break;
+        }
+    }
+
+    reply(out);
+}
+
+void Emulator::Unit::reply(ext::BufferStream& stream)
+{
+    stream.pad(64, 0x00U);
+
+    // Replies leave the device in order, each no sooner than the configured latency
+    replies.push(Replies::Clock::now() + latency, stream.data());
+}
+
+int Emulator::Unit::read(uint8_t* data, size_t size, int timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return replies.read(lock, data, size, timeout);
+}
+
+void Emulator::Unit::erase(MemoryInfo::Type type)
+{
+    for (size_t i = 0; i < memInfo.size(); ++i) {
+        if (memInfo[i].type == type) {
+            std::fill(blocks[i].begin(), blocks[i].end(), 0xFFU);
+            std::fill(sealed[i].begin(), sealed[i].end(), false);
+        }
+    }
+}
+
+uint8_t* Emulator::Unit::at(uint32_t address, uint32_t size)
+{
+    for (size_t i = 0; i < memInfo.size(); ++i) {
+        const auto& m = memInfo[i];
+        if (address >= m.address && address + size <= m.address + m.length) {
+            return blocks[i].data() + (address - m.address);
+        }
+    }
+
+    return nullptr;
+}
+
+bool Emulator::Unit::readable(uint32_t address, uint32_t size) const
+{
+    // The boot flash and ciphered firmware are code protected, they can only be checked with verify
+    for (size_t i = 0; i < memInfo.size(); ++i) {
+        const auto& m = memInfo[i];
+        if (address >= m.address + m.length || address + size <= m.address) {
+            continue;
+        }
+
+        if (m.type == MemoryInfo::BOOTLOADER) {
+            return false;
+        }
+
+        const uint32_t begin = std::max(address, m.address) - m.address;
+        const uint32_t end = std::min(address + size, m.address + m.length) - m.address;
+        if (std::find(sealed[i].begin() + begin, sealed[i].begin() + end, true) != sealed[i].begin() + end) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Emulator::Unit::seal(uint32_t address)
+{
+    for (size_t i = 0; i < memInfo.size(); ++i) {
+        const auto& m = memInfo[i];
+        if (address >= m.address && address < m.address + m.length) {
+            sealed[i][address - m.address] = true;
+        }
+    }
+}
+
+Emulator::Device::Device(std::string path, std::shared_ptr<Unit> unit, uint16_t pid)
+    : HID::Device(std::move(path))
+    , mUnit(std::move(unit))
+    , mPid(pid)
+{}
+
+Emulator::Device::~Device()
+{
+    close();
+}
+
+bool Emulator::Device::open()
+{
+    std::unique_lock<std::mutex> lock(mUnit->mutex);
+    if (mOpen) {
+        Logger::warning<Emulator::Device>("open") << "Already opened";
+        return false;
+    }
+
+    bool boot = (mUnit->mode == Flasher::MODE_BOOT);
+    if (boot != (mPid == Flasher::GB_BOOT_PID)) {
+        return false;
+    }
+
+    mGeneration = mUnit->replies.generation();
+    mOpen = true;
+    return true;
+}
+
+void Emulator::Device::close()
+{
+    mOpen = false;
+}
+
+bool Emulator::Device::isOpen() const
+{
+    std::unique_lock<std::mutex> lock(mUnit->mutex);
+    return mOpen && mGeneration == mUnit->replies.generation();
+}
+
+int Emulator::Device::fd() const
+{
+    return mUnit->replies.fd();
+}
+
+int Emulator::Device::readReport(uint8_t* data, size_t size, int timeout)
+{
+    // The device's side of the exchange isn't part of the host's report path
+    ext::Allocations::Pause pause;
+    return mUnit->read(data, size, timeout);
+}
+
+int Emulator::Device::writeReport(const uint8_t* data, size_t size)
+{
+    ext::Allocations::Pause pause;
+    mUnit->handle(mPid, data, size);
+    return size;
+}
+
+Emulator::Emulator(uint32_t units, std::vector<MemoryInfo> memInfo)
+{
+    for (uint32_t i = 0; i < units; ++i) {
+        mUnits.push_back(std::make_shared<Unit>(i, memInfo));
+    }
+}
+
+std::vector<MemoryInfo> Emulator::defaultMemInfo()
+{
+    return {
+        {MemoryInfo::APPLICATION, 0x1D000000U, 0x0007F000U},
+        {MemoryInfo::APPINFO, 0x1D07F000U, 0x00001000U},
+        {MemoryInfo::BOOTLOADER, 0x1FC00000U, 0x00002FF0U},
+        {MemoryInfo::CONFIG, 0x1FC02FF0U, 0x00000010U},
+    };
+}
+
+uint8_t Emulator::cipher(uint32_t address)
+{
+    return static_cast<uint8_t>(((address ^ 0xA5A5A5A5U) * 2654435761U) >> 24U);
+}
+
+void Emulator::setLatency(std::chrono::microseconds latency)
+{
+    for (auto& u: mUnits) {
+        std::unique_lock<std::mutex> lock(u->mutex);
+        u->latency = latency;
+    }
+}
+
+std::vector<HID::Entry> Emulator::enumerate(uint16_t vid, uint16_t pid, int interfaceNum)
+{
+    std::vector<HID::Entry> ret;
+    if (vid != Flasher::GB_VID) {
+        return ret;
+    }
+
+    for (auto& u: mUnits) {
+        std::unique_lock<std::mutex> lock(u->mutex);
+        char path[32], serial[16];
+        snprintf(serial, sizeof(serial), "EMU%04u", u->index);
+        if (u->mode == Flasher::MODE_BOOT && pid == Flasher::GB_BOOT_PID && interfaceNum <= 0) {
+            snprintf(path, sizeof(path), "emu:%u:%04X:0", u->index, pid);
+            ret.push_back({path, serial});
+        } else if (u->mode == Flasher::MODE_REGULAR && pid == Flasher::GB_PID) {
+            for (int i = 0; i < 2; ++i) {
+                if (interfaceNum == -1 || interfaceNum == i) {
+                    snprintf(path, sizeof(path), "emu:%u:%04X:%d", u->index, pid, i);
+                    ret.push_back({path, serial});
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+std::shared_ptr<HID::Device> Emulator::device(const std::string& path)
+{
+    uint32_t index = 0, pid = 0;
+    int interfaceNum = 0;
+    if (sscanf(path.c_str(), "emu:%u:%X:%d", &index, &pid, &interfaceNum) != 3 || index >= mUnits.size()) {
+        return nullptr;
+    }
+
+    return std::make_shared<Device>(path, mUnits[index], pid);
+}
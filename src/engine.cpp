@@ -0,0 +1,259 @@
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "ext/bufferview.h"
+#include "flasher.h"
+#include "logger.h"
+
+Engine::Engine(const FlashFile& file, const DeviceInfo& info, bool reset)
+{
+    // Every device runs the same sequence of reports, so it is built once up front
+    mProgram.push_back({Flasher::CMD_ERASE, nullptr, {}, false, true});
+    mProgram.push_back({Flasher::CMD_DEVICEINFO, nullptr, {}, false, true});
+
+    // Contiguous plaintext records go out as full reports, the program points into these
+    MemoryInfo::ALL([&](auto t) {
+        if (file.has(t)) {
+            mRecords[t] = FlashFile::coalesce(file.cmds(t), Flasher::PAYLOAD_SIZE, mScratch[t]);
+        }
+
+        return true;
+    });
+
+    uint32_t address = 0xFFFFFFFFU;
+    for (const auto& f: mRecords[MemoryInfo::APPLICATION]) {
+        if (address != 0xFFFFFFFFU && address != f.address) {
+            mProgram.push_back({Flasher::CMD_WRITE_COMPLETE, nullptr, {}, false, true});
+        }
+
+        mProgram.push_back({f.encrypted ? Flasher::CMD_WRITE_CIPHERED : Flasher::CMD_WRITE, &f, {}, true, true});
+        address = f.address + f.length();
+    }
+
+    if (address != 0xFFFFFFFFU) {
+        mProgram.push_back({Flasher::CMD_WRITE_COMPLETE, nullptr, {}, false, true});
+    }
+
+    MemoryInfo::ALL([&](auto t) {
+        if (file.has(t)) {
+            for (const auto& f: mRecords.at(t)) {
+                mProgram.push_back({f.encrypted ? Flasher::CMD_VERIFY_CIPHERED : Flasher::CMD_VERIFY, &f, {}, true, true});
+            }
+        }
+
+        return true;
+    });
+
+    for (auto& segment: Flasher::segments(info.address(MemoryInfo::APPINFO), file.appInfo()->data())) {
+        mProgram.push_back({Flasher::CMD_SET_APPINFO, nullptr, std::move(segment), false, true});
+    }
+
+    mProgram.push_back({Flasher::CMD_SIGN, nullptr, {}, false, true});
+    if (reset) {
+        mProgram.push_back({Flasher::CMD_RESET, nullptr, {}, false, false});
+    }
+}
+
+bool Engine::add(std::shared_ptr<HID::Device> dev)
+{
+    if (!dev || (!dev->isOpen() && !dev->open())) {
+        return false;
+    }
+
+    if (dev->fd() < 0) {
+        Logger::error<Engine>("add") << dev->path() << "can't be polled, use a pollable backend";
+        return false;
+    }
+
+    Slot slot;
+    slot.dev = std::move(dev);
+    slot.result = {slot.dev->path(), false, 0, 0, {}, {}};
+    mSlots.push_back(std::move(slot));
+    return true;
+}
+
+uint32_t Engine::addBootDevices(const std::string& serial)
+{
+    if (!serial.empty()) {
+        auto dev = HID::find(Flasher::GB_VID, Flasher::GB_BOOT_PID, -1, serial);
+        return (!!dev && add(dev)) ? 1 : 0;
+    }
+
+    uint32_t ret = 0;
+    for (auto& dev: HID::findAll(Flasher::GB_VID, Flasher::GB_BOOT_PID)) {
+        if (add(dev)) {
+            ++ret;
+        }
+    }
+
+    return ret;
+}
+
+std::vector<Engine::Result> Engine::run()
+{
+    mEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpoll < 0) {
+        Logger::error<Engine>("run") << "epoll_create1 failed:" << strerror(errno);
+        return {};
+    }
+
+    mActive = mSlots.size();
+    for (uint32_t i = 0; i < mSlots.size(); ++i) {
+        auto& slot = mSlots[i];
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        slot.start = std::chrono::steady_clock::now();
+        if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, slot.dev->fd(), &ev) < 0) {
+            finish(slot, false, "epoll_ctl failed");
+            continue;
+        }
+
+        post(slot);
+    }
+
+    std::vector<struct epoll_event> events(mSlots.size() + 1);
+    while (mActive > 0) {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + std::chrono::seconds(10);
+        for (const auto& slot: mSlots) {
+            if (slot.active) {
+                next = std::min(next, slot.deadline);
+            }
+        }
+
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+        int n = epoll_wait(mEpoll, events.data(), events.size(), std::max<int64_t>(timeout, 0) + 1);
+        if (n < 0 && errno != EINTR) {
+            Logger::error<Engine>("run") << "epoll_wait failed:" << strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            auto& slot = mSlots[events[i].data.u32];
+            if (slot.active) {
+                handle(slot);
+            }
+        }
+
+        now = std::chrono::steady_clock::now();
+        for (auto& slot: mSlots) {
+            if (slot.active && now >= slot.deadline) {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "no reply to %02X within %u ms", mProgram[slot.step].cmd, static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - slot.sent).count()));
+                finish(slot, false, buf);
+            }
+        }
+    }
+
+    ::close(mEpoll);
+    mEpoll = -1;
+
+    std::vector<Result> ret;
+    for (const auto& slot: mSlots) {
+        ret.push_back(slot.result);
+    }
+
+    return ret;
+}
+
+ext::Rtt& Engine::rtt(Slot& slot, uint8_t cmd)
+{
+    if (cmd == Flasher::CMD_ERASE) {
+        return slot.eraseRtt;
+    }
+
+    return Flasher::programs(cmd) ? slot.programRtt : slot.rtt;
+}
+
+void Engine::post(Slot& slot)
+{
+    const auto& step = mProgram[slot.step];
+    auto& r = slot.request;
+    r.fill(0x00U);
+    r[0] = Flasher::REPORT_NORMAL;
+    r[1] = step.cmd;
+    if (step.record != nullptr) {
+        if (step.record->encode(&r[2], r.size() - 2) == 0) {
+            finish(slot, false, "record exceeds maximum packet size");
+            return;
+        }
+    } else {
+        std::copy(step.data.begin(), step.data.end(), r.begin() + 2);
+    }
+
+    if (!slot.dev->write(r)) {
+        finish(slot, false, "write failed");
+        return;
+    }
+
+    ++slot.result.reports;
+    if (!step.reply) {
+        finish(slot, true);
+        return;
+    }
+
+    slot.sent = std::chrono::steady_clock::now();
+    slot.deadline = slot.sent + rtt(slot, step.cmd).timeout();
+}
+
+void Engine::handle(Slot& slot)
+{
+    const auto& step = mProgram[slot.step];
+    auto len = slot.dev->read(slot.reply, 0);
+    if (len <= 1) {
+        finish(slot, false, "read failed");
+        return;
+    }
+
+    rtt(slot, step.cmd).sample(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - slot.sent));
+
+    if (slot.reply[0] != step.cmd) {
+        finish(slot, false, "unexpected reply");
+        return;
+    }
+
+    if (step.result) {
+        ext::BufferView view(slot.reply.data() + 1, len - 1);
+        auto address = view.readUInt32();
+        auto result = static_cast<int32_t>(view.readUInt32());
+        if (result < 0) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "command %02X at %08X failed - result %d", step.cmd, address, result);
+            finish(slot, false, buf);
+            return;
+        }
+    }
+
+    if (++slot.step == mProgram.size()) {
+        finish(slot, true);
+        return;
+    }
+
+    post(slot);
+}
+
+void Engine::finish(Slot& slot, bool success, std::string error)
+{
+    if (!slot.active) {
+        return;
+    }
+
+    if (mEpoll >= 0) {
+        epoll_ctl(mEpoll, EPOLL_CTL_DEL, slot.dev->fd(), nullptr);
+    }
+
+    slot.active = false;
+    slot.result.success = success;
+    slot.result.error = std::move(error);
+    slot.result.ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - slot.start).count();
+    slot.result.srtt = slot.rtt.srtt();
+    --mActive;
+
+    if (!success) {
+        Logger::error<Engine>("finish") << slot.dev->path() << slot.result.error;
+    }
+}
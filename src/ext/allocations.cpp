@@ -0,0 +1,61 @@
+#include <cstdlib>
+#include <new>
+
+#include "ext/allocations.h"
+
+using namespace ext;
+
+#ifdef COUNT_ALLOCATIONS
+namespace {
+thread_local uint64_t sCount = 0;
+thread_local uint32_t sPaused = 0;
+}
+
+void* operator new(std::size_t size)
+{
+    if (sPaused == 0) {
+        ++sCount;
+    }
+
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+Allocations::Pause::Pause()
+{
+    ++sPaused;
+}
+
+Allocations::Pause::~Pause()
+{
+    --sPaused;
+}
+
+uint64_t Allocations::count()
+{
+    return sCount;
+}
+#else
+Allocations::Pause::Pause() {}
+
+Allocations::Pause::~Pause() {}
+
+uint64_t Allocations::count()
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,13 @@
+#include <algorithm>
+
+#include "ext/bufferview.h"
+
+using namespace ext;
+
+BufferView BufferView::readView(size_t count)
+{
+    auto len = std::min(count, remain());
+    BufferView ret(mData + mOffset, len);
+    mOffset += len;
+    return ret;
+}
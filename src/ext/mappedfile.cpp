@@ -0,0 +1,71 @@
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ext/mappedfile.h"
+#include "logger.h"
+
+using namespace ext;
+
+MappedFile::MappedFile(const std::string& path)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+        Logger::verbose<MappedFile>("MappedFile") << path << "does not exist";
+        mMissing = true;
+        return;
+    }
+
+    if (fd < 0) {
+        Logger::error<MappedFile>("MappedFile") << "Could not open" << path;
+        return;
+    }
+
+    // Empty files and ones that can't be mapped, like pipes, are read below
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        auto* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // Records are scanned front to back exactly once
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            mData = static_cast<const char*>(p);
+            mSize = st.st_size;
+            mMapped = true;
+            mValid = true;
+        }
+    }
+
+    ::close(fd);
+    if (mValid) {
+        return;
+    }
+#endif
+
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) {
+        Logger::error<MappedFile>("MappedFile") << "Could not open" << path;
+        return;
+    }
+
+    mBuffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    mData = mBuffer.data();
+    mSize = mBuffer.size();
+    mValid = true;
+}
+
+MappedFile::~MappedFile()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (mMapped) {
+        munmap(const_cast<char*>(mData), mSize);
+    }
+#endif
+}
@@ -0,0 +1,32 @@
+#include <algorithm>
+
+#include "ext/rtt.h"
+
+using namespace ext;
+
+Rtt::Rtt(std::chrono::milliseconds initial, std::chrono::milliseconds min, std::chrono::milliseconds max)
+    : mMin(min)
+    , mMax(max)
+    , mRto(initial)
+{
+}
+
+void Rtt::sample(std::chrono::microseconds rtt)
+{
+    if (mSamples++ == 0) {
+        mSrtt = rtt;
+        mRttvar = rtt / 2;
+    } else {
+        auto delta = (mSrtt > rtt) ? mSrtt - rtt : rtt - mSrtt;
+        mRttvar = (mRttvar * 3 + delta) / 4;
+        mSrtt = (mSrtt * 7 + rtt) / 8;
+    }
+
+    // 1 ms clock granularity
+    mRto = std::min(mMax, std::max(mMin, mSrtt + std::max<std::chrono::microseconds>(std::chrono::milliseconds(1), mRttvar * 4)));
+}
+
+void Rtt::backoff()
+{
+    mRto = std::min(mMax, mRto * 2);
+}
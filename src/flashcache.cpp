@@ -0,0 +1,238 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ext/bufferstream.h"
+#include "ext/bufferview.h"
+#include "ext/mappedfile.h"
+#include "flashcache.h"
+#include "logger.h"
+#include "utils/hex.h"
+
+namespace {
+const uint8_t MAGIC[4] = {'G', 'B', 'F', 'C'};
+}
+
+FlashCache::FlashCache(std::string dir)
+    : mDir(std::move(dir))
+{
+#if defined(_WIN32)
+    _mkdir(mDir.c_str());
+#else
+    mkdir(mDir.c_str(), 0755);
+#endif
+}
+
+std::unique_ptr<FlashFile> FlashCache::load(const std::string& path, const DeviceInfo& deviceInfo)
+{
+    ext::MappedFile source(path);
+    if (source.missing()) {
+        Logger::error<FlashCache>("load") << path << "does not exist";
+    }
+
+    if (!source) {
+        return nullptr;
+    }
+
+    auto k = key(source.data(), source.size(), deviceInfo);
+    auto cachePath = mDir + "/" + utils::Hex::toString(k.data(), k.size()) + ".gbfc";
+
+    auto ret = read(cachePath, k);
+    if (!!ret) {
+        Logger::verbose<FlashCache>("load") << "Loaded" << path << "from" << cachePath;
+        return ret;
+    }
+
+    ret.reset(new FlashFile());
+    ret->load(source.data(), source.size(), deviceInfo);
+    if (*ret && write(cachePath, k, *ret)) {
+        Logger::verbose<FlashCache>("load") << "Cached" << path << "as" << cachePath;
+    }
+
+    return ret;
+}
+
+std::unique_ptr<FlashFile> FlashCache::read(const std::string& path, const utils::SHA256::Digest& key)
+{
+    std::unique_ptr<ext::MappedFile> cache(new ext::MappedFile(path));
+    if (!*cache) {
+        return nullptr;
+    }
+
+    ext::BufferView view(reinterpret_cast<const uint8_t*>(cache->data()), cache->size());
+    auto magic = view.readView(sizeof(MAGIC));
+    auto version = view.readUInt32();
+    auto stored = view.readView(key.size());
+    if (magic.size() != sizeof(MAGIC) || memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0 || version != VERSION
+        || stored.size() != key.size() || memcmp(stored.data(), key.data(), key.size()) != 0) {
+        Logger::warning<FlashCache>("read") << path << "is stale or not a cache file, ignoring";
+        return nullptr;
+    }
+
+    std::unique_ptr<FlashFile> ret(new FlashFile());
+    auto appInfoLen = view.readUInt32();
+    auto appInfo = view.readView(appInfoLen);
+    if (appInfo.size() != appInfoLen) {
+        return nullptr;
+    }
+
+    ret->mAppInfo = std::make_shared<AppInfo>(appInfo.toVector());
+
+    auto pageCount = view.readUInt32();
+    if (view.remain() / PAGE_ENTRY_SIZE < pageCount) {
+        Logger::warning<FlashCache>("read") << path << "is truncated, ignoring";
+        return nullptr;
+    }
+
+    std::vector<MemoryImage::Page> pages(pageCount);
+    for (uint32_t i = 0; i < pageCount; ++i) {
+        pages[i].address = view.readUInt32();
+        pages[i].offset = i * MemoryImage::PAGE_SIZE;
+        for (auto& v: pages[i].valid) {
+            uint64_t lo = view.readUInt32();
+            v = lo | (static_cast<uint64_t>(view.readUInt32()) << 32U);
+        }
+
+        if (i > 0 && pages[i].address <= pages[i - 1].address) {
+            Logger::warning<FlashCache>("read") << path << "has pages out of order, ignoring";
+            return nullptr;
+        }
+    }
+
+    auto bytes = view.readView(static_cast<size_t>(pageCount) * MemoryImage::PAGE_SIZE);
+    auto cipherLen = view.readUInt32();
+    auto cipher = view.readView(cipherLen);
+    if (bytes.size() != static_cast<size_t>(pageCount) * MemoryImage::PAGE_SIZE || cipher.size() != cipherLen) {
+        Logger::warning<FlashCache>("read") << path << "is truncated, ignoring";
+        return nullptr;
+    }
+
+    ret->mImage.map(bytes.data(), bytes.size(), std::move(pages));
+
+    auto types = view.readUInt32();
+    for (uint32_t t = 0; t < types; ++t) {
+        auto type = static_cast<MemoryInfo::Type>(view.readUInt8());
+        auto count = view.readUInt32();
+        auto& records = ret->mRecords[type];
+        records.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (view.remain() < RECORD_SIZE) {
+                Logger::warning<FlashCache>("read") << path << "is truncated, ignoring";
+                return nullptr;
+            }
+
+            FlashFile::Record r;
+            r.address = view.readUInt32();
+            r.cmd = view.readUInt8();
+            r.encrypted = (view.readUInt8() & 0x01U) != 0;
+            r.padding = view.readUInt8();
+            r.size = view.readUInt8();
+            auto offset = view.readUInt32();
+            if (r.encrypted) {
+                r.data = (offset + r.size <= cipher.size()) ? cipher.data() + offset : nullptr;
+            } else {
+                r.data = ret->mImage.at(r.address, r.size);
+            }
+
+            if (r.data == nullptr) {
+                Logger::warning<FlashCache>("read") << path << "points outside its data, ignoring";
+                return nullptr;
+            }
+
+            records.push_back(r);
+        }
+    }
+
+    ret->mMapping = std::move(cache);
+    ret->mValid = !!ret->mAppInfo && !ret->mRecords.empty();
+    return *ret ? std::move(ret) : nullptr;
+}
+
+bool FlashCache::write(const std::string& path, const utils::SHA256::Digest& key, const FlashFile& file)
+{
+    ext::BufferStream stream;
+    stream.append(std::vector<uint8_t>(MAGIC, MAGIC + sizeof(MAGIC)));
+    stream.appendDword(VERSION);
+    stream.append(std::vector<uint8_t>(key.begin(), key.end()));
+
+    auto appInfo = file.appInfo()->data();
+    stream.appendDword(appInfo.size());
+    stream.append(appInfo);
+
+    const auto& pages = file.mImage.pages();
+    stream.appendDword(pages.size());
+    for (const auto& p: pages) {
+        stream.appendDword(p.address);
+        for (auto v: p.valid) {
+            stream.appendQword(v);
+        }
+    }
+
+    // Compacted, so the pages already lie back to back in address order
+    const auto* bytes = pages.empty() ? nullptr : file.mImage.data(pages.front());
+    stream.append(std::vector<uint8_t>(bytes, bytes + pages.size() * MemoryImage::PAGE_SIZE));
+
+    stream.appendDword(file.mCipher.size());
+    stream.append(file.mCipher);
+
+    stream.appendDword(file.mRecords.size());
+    for (const auto& t: file.mRecords) {
+        stream.append(static_cast<uint8_t>(t.first));
+        stream.appendDword(t.second.size());
+        for (const auto& r: t.second) {
+            stream.appendDword(r.address);
+            stream.append(r.cmd);
+            stream.append(static_cast<uint8_t>(r.encrypted ? 0x01U : 0x00U));
+            stream.append(r.padding);
+            stream.append(r.size);
+            stream.appendDword(r.encrypted ? static_cast<uint32_t>(r.data - file.mCipher.data()) : 0U);
+        }
+    }
+
+    // Written aside and renamed into place so a concurrent reader never sees a partial file
+#if defined(_WIN32)
+    auto tmp = path + "." + std::to_string(_getpid());
+#else
+    auto tmp = path + "." + std::to_string(getpid());
+#endif
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        Logger::warning<FlashCache>("write") << "Could not create" << tmp << ":" << strerror(errno);
+        return false;
+    }
+
+    const auto data = stream.data();
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        Logger::warning<FlashCache>("write") << "Could not write" << path;
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+utils::SHA256::Digest FlashCache::key(const char* data, size_t size, const DeviceInfo& deviceInfo)
+{
+    utils::SHA256 sha;
+    sha.update(data, size);
+
+    ext::BufferStream memory;
+    memory.appendDword(VERSION);
+    for (const auto& m: deviceInfo.memInfo()) {
+        memory.append(static_cast<uint8_t>(m.type));
+        memory.appendDword(m.address);
+        memory.appendDword(m.length);
+    }
+
+    return sha.update(memory.data()).digest();
+}
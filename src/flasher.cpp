@@ -1,3 +1,5 @@
+#include <array>
+#include <bitset>
 #include <chrono>
 #include <map>
 #include <thread>
@@ -7,16 +9,110 @@
 #include "flasher.h"
 #include "flashfile.h"
 #include "hid.h"
+#ifdef __linux__
+#include "hotplug.h"
+#endif
 #include "logger.h"
-#include "utils/hex.h"
+
+Flasher::Flasher(std::string serial)
+    : mSerial(std::move(serial))
+    , mBoot(GB_VID, GB_BOOT_PID, -1, mSerial)
+    , mRegular(GB_VID, GB_PID, 1, mSerial)
+    , mRtt(commandRtt())
+    , mProgramRtt(programRtt())
+    , mEraseRtt(eraseRtt())
+    , mSent(PROBE_WINDOW)
+{}
+
+void Flasher::setWindow(uint32_t window)
+{
+    mWindow = std::max<uint32_t>(1, window);
+    mSent.resize(std::max(mWindow, mProbeWindow));
+}
+
+void Flasher::setProbeWindow(uint32_t window)
+{
+    mProbeWindow = std::max<uint32_t>(1, window);
+    mSent.resize(std::max(mWindow, mProbeWindow));
+}
+
+Flasher::Stats Flasher::stats() const
+{
+    auto ret = mStats;
+    ret.samples = mRtt.samples();
+    ret.srtt = mRtt.srtt();
+    ret.rttvar = mRtt.rttvar();
+    ret.timeout = mRtt.timeout();
+    return ret;
+}
+
+ext::Rtt Flasher::commandRtt()
+{
+    return ext::Rtt(std::chrono::seconds(1), std::chrono::milliseconds(100), std::chrono::seconds(10));
+}
+
+ext::Rtt Flasher::programRtt()
+{
+    return ext::Rtt(std::chrono::seconds(10), std::chrono::seconds(5), std::chrono::seconds(30));
+}
+
+ext::Rtt Flasher::eraseRtt()
+{
+    return ext::Rtt(std::chrono::seconds(30), std::chrono::seconds(2), std::chrono::seconds(60));
+}
+
+ext::Rtt& Flasher::rtt(uint8_t cmd)
+{
+    if (cmd == CMD_ERASE) {
+        return mEraseRtt;
+    }
+
+    return programs(cmd) ? mProgramRtt : mRtt;
+}
+
+bool Flasher::programs(uint8_t cmd)
+{
+    return cmd == CMD_WRITE_COMPLETE || cmd == CMD_SIGN || cmd == CMD_SET_APPINFO;
+}
+
+bool Flasher::idempotent(uint8_t cmd)
+{
+    switch (cmd) {
+    case CMD_DEVICEINFO:
+    case CMD_GET_DATA:
+    case CMD_VERIFY:
+    case CMD_VERIFY_CIPHERED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::vector<std::string> Flasher::serials()
+{
+    std::vector<std::string> ret;
+    auto add = [&](const std::vector<HID::Entry>& entries) {
+        for (const auto& e: entries) {
+            if (e.serial.empty()) {
+                Logger::warning<Flasher>("serials") << e.path << "has no serial number, skipping";
+            } else if (std::find(ret.begin(), ret.end(), e.serial) == ret.end()) {
+                ret.push_back(e.serial);
+            }
+        }
+    };
+
+    add(HID::enumerate(GB_VID, GB_BOOT_PID));
+    add(HID::enumerate(GB_VID, GB_PID, 1));
+    return ret;
+}
 
 std::shared_ptr<DeviceInfo> Flasher::deviceInfo()
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
         auto data = send(bootDev, CMD_DEVICEINFO);
         if (!data.empty()) {
-            return std::make_shared<DeviceInfo>(data);
+            return std::make_shared<DeviceInfo>(data.toVector());
         }
     }
 
@@ -25,8 +121,8 @@ std::shared_ptr<DeviceInfo> Flasher::deviceInfo()
 
 std::shared_ptr<AppInfo> Flasher::appInfo()
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
         auto data = readSegmented(bootDev, CMD_GET_APPINFO);
         if (!data.empty()) {
             return std::make_shared<AppInfo>(data);
@@ -38,8 +134,8 @@ std::shared_ptr<AppInfo> Flasher::appInfo()
 
 bool Flasher::erase()
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
         auto data = send(bootDev, CMD_ERASE);
         if (!data.empty()) {
             return !send(bootDev, CMD_DEVICEINFO).empty();
@@ -64,62 +160,227 @@ bool Flasher::flash(const FlashFile& file, const DeviceInfo& info)
 
 bool Flasher::flashMemory(const FlashFile& file, const DeviceInfo& info, MemoryInfo::Type memType)
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
-        uint32_t address = 0xFFFFFFFFU;
-        for (const auto& p: file.cmds(memType)) {
-            const auto& f = p.second;
-            if (address == 0xFFFFFFFFU) {
-                address = f.address;
-            }
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
+        // Records are written in runs of contiguous addresses, each run is closed with a write complete
+        // Contiguous plaintext records go out as full reports
+        std::vector<uint8_t> scratch;
+        auto records = FlashFile::coalesce(file.cmds(memType), PAYLOAD_SIZE, scratch);
+        Logger::info<Flasher>("flashMemory") ("Writing %u records in %u reports", static_cast<uint32_t>(file.cmds(memType).size()), static_cast<uint32_t>(records.size()));
 
-            if (address != f.address) {
-                auto ret = send(bootDev, CMD_WRITE_COMPLETE);
-                if (ret.empty()) {
-                    Logger::error<Flasher>("flashMemory") << "Write complete failed";
+        std::vector<const FlashFile::Record*> run;
+        run.reserve(records.size());
+        uint32_t address = 0xFFFFFFFFU;
+        for (const auto& f: records) {
+            if (!run.empty() && address != f.address) {
+                if (!writeRun(bootDev, run)) {
                     return false;
                 }
 
-                address = f.address;
+                run.clear();
             }
 
-            auto res = sendResult(bootDev, f.encrypted ? CMD_WRITE_CIPHERED : CMD_WRITE, f.encoded());
-            if (res.result < 0) {
-                Logger::error<Flasher>("flashMemory") ("Write address %08X failed - result %d", f.address, res.result);
+            run.push_back(&f);
+            address = f.address + f.length();
+        }
+
+        if (!run.empty() && !writeRun(bootDev, run)) {
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool Flasher::writeRun(const std::shared_ptr<HID::Device>& dev, const std::vector<const FlashFile::Record*>& run)
+{
+    if (!writeRecords(dev, run)) {
+        return false;
+    }
+
+    auto ret = send(dev, CMD_WRITE_COMPLETE);
+    if (ret.empty()) {
+        Logger::error<Flasher>("writeRun") << "Write complete failed";
+        return false;
+    }
+
+    return true;
+}
+
+bool Flasher::writeRecords(const std::shared_ptr<HID::Device>& dev, const std::vector<const FlashFile::Record*>& run)
+{
+    // Records [acked, next) are in flight
+    uint32_t window = mWindow;
+    size_t acked = 0, next = 0;
+    mReceived = mPosted;
+    while (acked < run.size()) {
+        while (next < run.size() && next - acked < window) {
+            const auto& f = *run[next];
+            if (!postRecord(dev, f.encrypted ? CMD_WRITE_CIPHERED : CMD_WRITE, f)) {
+                Logger::error<Flasher>("writeRecords") ("Write address %08X failed - could not send", f.address);
                 return false;
             }
 
-            address += f.length();
+            ++next;
+        }
+
+        const auto& f = *run[acked];
+        auto res = receiveResult(dev, f.encrypted ? CMD_WRITE_CIPHERED : CMD_WRITE);
+        bool matched = (window == 1 || res.address == f.address);
+        if (res.result >= 0 && matched) {
+            ++acked;
+            continue;
+        }
+
+        if (window == 1 && res.result < 0) {
+            Logger::error<Flasher>("writeRecords") ("Write address %08X failed - result %d", f.address, res.result);
+            return false;
+        }
+
+        // The window broke, collect the replies still on their way and resend everything after the
+        // last acknowledged record one at a time
+        Logger::warning<Flasher>("writeRecords") ("Window failed at address %08X (%u in flight), falling back", f.address, static_cast<uint32_t>(next - acked));
+        for (size_t i = acked + 1; i < next; ++i) {
+            if (receive(dev, f.encrypted ? CMD_WRITE_CIPHERED : CMD_WRITE).empty()) {
+                break;
+            }
         }
 
-        if (address != 0xFFFFFFFFU) {
-            auto ret = send(bootDev, CMD_WRITE_COMPLETE);
-            if (ret.empty()) {
-                Logger::error<Flasher>("flashMemory") << "Write complete failed";
+        mStats.retransmits += static_cast<uint32_t>(next - acked);
+        mReceived = mPosted;
+        next = acked;
+        window = 1;
+    }
+
+    return true;
+}
+
+bool Flasher::flash(FlashStream& stream)
+{
+    auto bootDev = mBoot.device();
+    if (!bootDev) {
+        return false;
+    }
+
+    // Records arrive in file order, a run is only closed with a write complete where the addresses
+    // break, full batches in between are written without one
+    std::vector<FlashFile::Command> batch;
+    std::vector<FlashFile::Record> records;
+    std::vector<FlashFile::Record> packets;
+    std::vector<const FlashFile::Record*> run;
+    std::vector<uint8_t> scratch;
+    batch.reserve(STREAM_BATCH);
+    records.reserve(STREAM_BATCH);
+    run.reserve(STREAM_BATCH);
+    auto write = [&](bool complete) {
+        records.assign(batch.begin(), batch.end());
+        packets = FlashFile::coalesce(records, PAYLOAD_SIZE, scratch);
+        run.clear();
+        for (const auto& r: packets) {
+            run.push_back(&r);
+        }
+
+        bool ok = complete ? writeRun(bootDev, run) : writeRecords(bootDev, run);
+        batch.clear();
+        return ok;
+    };
+
+    uint32_t address = 0xFFFFFFFFU;
+    bool open = false;
+    MemoryInfo::Type type;
+    FlashFile::Command f;
+    while (stream.next(type, f)) {
+        // Only supports APPLICATION
+        if (type != MemoryInfo::APPLICATION) {
+            continue;
+        }
+
+        if (open && address != f.address) {
+            if (!write(true)) {
+                return false;
+            }
+
+            open = false;
+        } else if (batch.size() == STREAM_BATCH && !write(false)) {
+            return false;
+        }
+
+        address = f.address + f.length();
+        batch.push_back(std::move(f));
+        open = true;
+    }
+
+    if (!stream.ok()) {
+        Logger::error<Flasher>("flash") << "Stream failed, the application is incomplete";
+        return false;
+    }
+
+    return !open || write(true);
+}
+
+bool Flasher::verify(FlashStream& stream)
+{
+    auto bootDev = mBoot.device();
+    if (!bootDev) {
+        return false;
+    }
+
+    std::vector<FlashFile::Command> batch;
+    std::vector<FlashFile::Record> records;
+    std::vector<uint8_t> scratch;
+    batch.reserve(STREAM_BATCH);
+    auto verify = [&]() {
+        records.assign(batch.begin(), batch.end());
+        for (const auto& f: FlashFile::coalesce(records, PAYLOAD_SIZE, scratch)) {
+            auto res = toResult(sendRecord(bootDev, f.encrypted ? CMD_VERIFY_CIPHERED : CMD_VERIFY, f));
+            if (res.result < 0) {
+                Logger::error<Flasher>("verify") ("Verify address %08X failed - result %d", f.address, res.result);
                 return false;
             }
         }
 
+        batch.clear();
         return true;
+    };
+
+    MemoryInfo::Type type;
+    FlashFile::Command f;
+    while (stream.next(type, f)) {
+        batch.push_back(std::move(f));
+        if (batch.size() == STREAM_BATCH && !verify()) {
+            return false;
+        }
     }
 
-    return false;
+    return verify() && stream.ok();
 }
 
 bool Flasher::setAppInfo(const FlashFile& file, const DeviceInfo& deviceInfo, const AppInfo& appInfo)
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
+    return setAppInfo(deviceInfo, appInfo);
+}
+
+bool Flasher::setAppInfo(const DeviceInfo& deviceInfo, const AppInfo& appInfo)
+{
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
         auto start = deviceInfo.address(MemoryInfo::APPINFO);
         if (writeSegmented(bootDev, CMD_SET_APPINFO, start, appInfo.data())) {
-            auto r = send(bootDev, CMD_SIGN);
-            return (!r.empty());
+            return sign();
         }
     }
 
     return false;
 }
 
+bool Flasher::sign()
+{
+    auto bootDev = mBoot.device();
+    return !!bootDev && !send(bootDev, CMD_SIGN).empty();
+}
+
 bool Flasher::verify(const FlashFile& file, const DeviceInfo& info)
 {
     return MemoryInfo::ALL([&](auto t) {
@@ -131,15 +392,33 @@ bool Flasher::verify(const FlashFile& file, const DeviceInfo& info)
     });
 }
 
-bool Flasher::verifyMemory(const FlashFile& file, const DeviceInfo& info, MemoryInfo::Type memType)
+bool Flasher::matches(const FlashFile& file, const DeviceInfo& info)
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
-        for (const auto& p: file.cmds(memType)) {
-            const auto& f = p.second;
-            auto res = sendResult(bootDev, f.encrypted ? CMD_VERIFY_CIPHERED : CMD_VERIFY, f.encoded());
+    return MemoryInfo::ALL([&](auto t) {
+        if (file.has(t) && !verifyMemory(file, info, t, true)) {
+            return false;
+        }
+
+        return true;
+    });
+}
+
+bool Flasher::verifyMemory(const FlashFile& file, const DeviceInfo& info, MemoryInfo::Type memType, bool quiet)
+{
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
+        std::vector<uint8_t> scratch;
+        auto records = FlashFile::coalesce(file.cmds(memType), PAYLOAD_SIZE, scratch);
+        Logger::info<Flasher>("verifyMemory") ("Verifying %u records in %u reports", static_cast<uint32_t>(file.cmds(memType).size()), static_cast<uint32_t>(records.size()));
+        for (const auto& f: records) {
+            auto res = toResult(sendRecord(bootDev, f.encrypted ? CMD_VERIFY_CIPHERED : CMD_VERIFY, f));
             if (res.result < 0) {
-                Logger::error<Flasher>("verifyMemory") ("Verify address %08X failed - result %d", f.address, res.result);
+                if (quiet) {
+                    Logger::verbose<Flasher>("verifyMemory") ("Address %08X differs - result %d", f.address, res.result);
+                } else {
+                    Logger::error<Flasher>("verifyMemory") ("Verify address %08X failed - result %d", f.address, res.result);
+                }
+
                 return false;
             }
         }
@@ -153,31 +432,31 @@ bool Flasher::verifyMemory(const FlashFile& file, const DeviceInfo& info, Memory
 bool Flasher::switchMode(uint8_t mode)
 {
     if (mode == MODE_BOOT) {
-        // Check if we're already in boot mode
-        auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-        if (!!bootDev) {
+        // Check if we're already in boot mode, keeping the device open for the following commands
+        if (!!mBoot.device()) {
             Logger::verbose<Flasher>("switchMode") << "Already in boot mode";
             return true;
         }
 
         Logger::info<Flasher>("switchMode") << "Switching to boot mode";
-        auto dev = HID::find(GB_VID, GB_PID, 1);
-        if (!!dev && dev->open()) {
+        auto dev = mRegular.device();
+        if (!!dev) {
             // Don't check the result here as it's expected to fail
             dev->write(REPORT_BOOT, {CMD_BOOTLOADER});
+            mRegular.invalidate();
             return waitMode(mode);
         }
     } else if (mode == MODE_REGULAR) {
-        auto dev = HID::find(GB_VID, GB_PID, 1);
-        if (!!dev) {
+        if (mRegular.present()) {
             Logger::verbose<Flasher>("switchMode") << "Already in regular mode";
             return true;
         }
 
         Logger::info<Flasher>("switchMode") << "Switching to regular mode";
-        auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-        if (!!bootDev && bootDev->open()) {
-            bootDev->write({CMD_RESET});
+        auto bootDev = mBoot.device();
+        if (!!bootDev) {
+            bootDev->write(REPORT_NORMAL, {CMD_RESET});
+            mBoot.invalidate();
             return waitMode(mode);
         }
     }
@@ -185,38 +464,382 @@ bool Flasher::switchMode(uint8_t mode)
     return false;
 }
 
-std::vector<uint8_t> Flasher::readData(uint32_t address, uint32_t size)
+void Flasher::close()
+{
+    mBoot.invalidate();
+    mRegular.invalidate();
+}
+
+void Flasher::setProbeModel(std::shared_ptr<ProbeModel> model)
+{
+    mModel = std::move(model);
+}
+
+ProbeModel& Flasher::probeModel()
+{
+    if (!mModel) {
+        mModel = std::make_shared<ProbeModel>();
+    }
+
+    return *mModel;
+}
+
+bool Flasher::dump(uint32_t address, uint32_t size, const Sink& sink, const MemoryImage* reference)
+{
+    auto bootDev = mBoot.device();
+    if (!bootDev) {
+        return false;
+    }
+
+    bool bulk = true;
+    uint32_t probed = 0;
+    std::array<uint8_t, GET_DATA_SIZE> block;
+    for (uint32_t offset = 0; offset < size;) {
+        const uint32_t addr = address + offset;
+        const uint32_t n = std::min<uint32_t>(GET_DATA_SIZE, size - offset);
+        int32_t res = bulk ? getData(bootDev, addr, n, block.data()) : 0;
+        if (res == 0 && bulk) {
+            // Older bootloaders ignore the command, don't wait for every block to time out
+            Logger::warning<Flasher>("dump") << "No reply to CMD_GET_DATA, probing the rest";
+            bulk = false;
+            bootDev = mBoot.device();
+            if (!bootDev) {
+                return false;
+            }
+        }
+
+        if (res == -2) {
+            // Outside the device memory, probing would never find a matching byte
+            Logger::error<Flasher>("dump") ("Address %08X is out of range", addr);
+            return false;
+        } else if (res <= 0) {
+            Logger::verbose<Flasher>("dump") ("Reading %08X refused (%d), probing", addr, res);
+            if (probeData(bootDev, addr, n, reference, block.data()) != n) {
+                Logger::error<Flasher>("dump") ("Failed reading address %08X", addr);
+                return false;
+            }
+
+            probed += n;
+        }
+
+        if (!sink(addr, block.data(), n)) {
+            return false;
+        }
+
+        offset += n;
+    }
+
+    Logger::verbose<Flasher>("dump") ("Read %u bytes from %08X, %u of them probed", size, address, probed);
+    return true;
+}
+
+std::vector<uint8_t> Flasher::readData(uint32_t address, uint32_t size, const MemoryImage* reference)
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
-        std::vector<uint8_t> ret;
-        for (uint32_t offset = 0; offset < size; ++offset) {
-            for (uint8_t i = 0xFFU; i >= 0x00U; --i) {
-                ext::BufferStream stream;
-                stream.appendDword(address + offset);
-                stream.appendDword(0x1U);
-                stream.append(i);
+    std::vector<uint8_t> ret;
+    ret.reserve(size);
+    bool ok = dump(address, size, [&ret](uint32_t, const uint8_t* data, size_t n) {
+        ret.insert(ret.end(), data, data + n);
+        return true;
+    }, reference);
 
-                auto res = sendResult(bootDev, CMD_VERIFY, stream.data());
-                if (res.result >= 0) {
-                    printf("%02X", i);
-                    fflush(stdout);
-                    ret.emplace_back(i);
+    return ok ? ret : std::vector<uint8_t>();
+}
+
+int32_t Flasher::getData(const std::shared_ptr<HID::Device>& dev, uint32_t address, uint32_t size, uint8_t* dst)
+{
+    const uint8_t request[] = {
+        _byte(address), _byte(address >> 8U), _byte(address >> 16U), _byte(address >> 24U),
+        _byte(size), _byte(size >> 8U), _byte(size >> 16U), _byte(size >> 24U),
+    };
+
+    auto reply = send(dev, CMD_GET_DATA, {request, sizeof(request)});
+    if (reply.empty()) {
+        return 0;
+    }
+
+    mGetData = true;
+
+    auto res = toResult(reply.readView(8));
+    if (res.result < 0) {
+        return res.result;
+    }
+
+    auto data = reply.readView(size);
+    if (res.address != address || data.size() != size) {
+        return 0;
+    }
+
+    std::copy(data.data(), data.data() + size, dst);
+    return static_cast<int32_t>(size);
+}
+
+uint32_t Flasher::probeData(const std::shared_ptr<HID::Device>& dev, uint32_t address, uint32_t size, const MemoryImage* reference, uint8_t* dst)
+{
+    size = std::min<uint32_t>(size, GET_DATA_SIZE);
+    std::array<bool, GET_DATA_SIZE> known{};
+    if (reference != nullptr) {
+        // Runs of bytes the reference has, each confirmed as a whole where it still matches
+        for (uint32_t offset = 0; offset < size;) {
+            uint32_t n = 0;
+            while (offset + n < size && reference->read(address + offset + n, &dst[offset + n], 1)) {
+                ++n;
+            }
+
+            if (n > 0) {
+                confirmData(dev, address + offset, &dst[offset], n, &known[offset]);
+            }
+
+            offset += std::max<uint32_t>(n, 1);
+        }
+    }
+
+    // Every byte gets its candidates in model order. Up to a window of probes is kept in flight across
+    // several addresses, each address's next candidate going out before any address gets one further down
+    // its order, and an address stops getting probes once one of them hits. Everything is sized for a
+    // block, so probing doesn't touch the heap.
+    struct Slot {
+        ProbeModel::Order order;
+        std::bitset<256> missed;
+        uint32_t next = 0;
+        bool active = false;
+    };
+
+    struct Probe {
+        uint32_t offset;
+        uint8_t value;
+    };
+
+    auto& model = probeModel();
+    uint32_t window = std::min(mProbeWindow, size);
+    std::array<Slot, GET_DATA_SIZE> slots;
+    std::array<bool, GET_DATA_SIZE> learned{};
+    // Probes in flight, oldest first at head
+    std::array<Probe, GET_DATA_SIZE> inflight;
+    uint32_t head = 0, pending = 0;
+    uint32_t active = 0, activated = 0, resolved = 0;
+    auto previous = [&](uint32_t offset) -> const uint8_t* {
+        return (offset > 0 && known[offset - 1]) ? &dst[offset - 1] : nullptr;
+    };
+
+    // Bytes hit out of order are learned once the byte before them is known, so the model sees every
+    // pair of neighbours
+    auto learn = [&](uint32_t offset) {
+        if (offset < size && known[offset] && !learned[offset] && (offset == 0 || known[offset - 1])) {
+            model.learn(address + offset, dst[offset], previous(offset));
+            learned[offset] = true;
+        }
+    };
+
+    // An address activated before the byte ahead of it was known got its order without it, the candidates
+    // not sent yet are ranked again now that it is
+    auto rerank = [&](uint32_t offset) {
+        auto& slot = slots[offset];
+        ProbeModel::Order order;
+        model.order(address + offset, previous(offset), order);
+        std::bitset<256> sent;
+        for (uint32_t i = 0; i < slot.next; ++i) {
+            sent.set(slot.order[i]);
+        }
+
+        uint32_t n = slot.next;
+        for (auto v: order) {
+            if (!sent[v]) {
+                slot.order[n++] = v;
+            }
+        }
+    };
+
+    auto resolve = [&](uint32_t offset) {
+        if (slots[offset].active) {
+            slots[offset].active = false;
+            --active;
+        }
+
+        known[offset] = true;
+        learn(offset);
+        learn(offset + 1);
+        if (offset + 1 < size && slots[offset + 1].active) {
+            rerank(offset + 1);
+        }
+
+        ++mStats.probed;
+        ++resolved;
+    };
+
+    // Replies to cancelled candidates are still on their way and would answer the next command
+    auto drain = [&]() {
+        for (; pending > 0; head = (head + 1) % GET_DATA_SIZE, --pending) {
+            ++mStats.probes;
+            if (receive(dev, CMD_VERIFY).empty()) {
+                break;
+            }
+        }
+
+        mReceived = mPosted;
+    };
+
+    // Everything up to the first byte left unknown
+    auto failed = [&]() {
+        drain();
+        return static_cast<uint32_t>(std::find(known.begin(), known.begin() + size, false) - known.begin());
+    };
+
+    for (uint32_t offset = 0; offset < size; ++offset) {
+        if (known[offset]) {
+            learn(offset);
+            ++mStats.probed;
+            ++mStats.predicted;
+            ++resolved;
+        }
+    }
+
+    mReceived = mPosted;
+    while (resolved < size) {
+        while (pending < window) {
+            Slot* slot = nullptr;
+            uint32_t offset = 0;
+            for (uint32_t i = 0; i < activated; ++i) {
+                if (slots[i].active && slots[i].next < 256 && (slot == nullptr || slots[i].next < slot->next)) {
+                    slot = &slots[i];
+                    offset = i;
+                }
+            }
+
+            if ((slot == nullptr || slot->next > 0) && active < window) {
+                while (activated < size && known[activated]) {
+                    ++activated;
+                }
+
+                if (activated < size) {
+                    offset = activated++;
+                    slot = &slots[offset];
+                    slot->active = true;
+                    ++active;
+                    model.order(address + offset, previous(offset), slot->order);
+                }
+            }
+
+            if (slot == nullptr || slot->next >= 256) {
+                break;
+            }
+
+            // Candidates already answered before the window broke aren't asked again
+            while (slot->next < 256 && slot->missed[slot->order[slot->next]]) {
+                ++slot->next;
+            }
+
+            if (slot->next >= 256) {
+                continue;
+            }
+
+            const uint32_t addr = address + offset;
+            const uint8_t value = slot->order[slot->next++];
+            const uint8_t probe[] = {
+                _byte(addr), _byte(addr >> 8U), _byte(addr >> 16U), _byte(addr >> 24U),
+                0x01U, 0x00U, 0x00U, 0x00U,
+                value,
+            };
+
+            if (!post(dev, CMD_VERIFY, {probe, sizeof(probe)})) {
+                Logger::error<Flasher>("probeData") ("Probing address %08X failed - could not send", addr);
+                return failed();
+            }
+
+            inflight[(head + pending++) % GET_DATA_SIZE] = {offset, value};
+        }
+
+        if (pending == 0) {
+            // Some byte ran out of candidates without a hit
+            return failed();
+        }
+
+        const auto probe = inflight[head];
+        head = (head + 1) % GET_DATA_SIZE;
+        --pending;
+        auto res = receiveResult(dev, CMD_VERIFY);
+        ++mStats.probes;
+        if (res.address != address + probe.offset) {
+            if (window == 1) {
+                return failed();
+            }
+
+            // Replies got lost or out of step, collect what is still on its way and carry on one probe
+            // at a time, the candidates left unanswered are sent again
+            Logger::warning<Flasher>("probeData") ("Window failed at address %08X (%u in flight), falling back", address + probe.offset,
+                pending + 1);
+            for (uint32_t i = 0; i < pending; ++i) {
+                if (receive(dev, CMD_VERIFY).empty()) {
                     break;
                 }
             }
+
+            pending = 0;
+            for (auto& s: slots) {
+                s.next = 0;
+            }
+
+            mReceived = mPosted;
+            window = 1;
+            continue;
+        }
+
+        if (known[probe.offset]) {
+            // Already found through another candidate
+            continue;
+        }
+
+        if (res.result >= 0) {
+            dst[probe.offset] = probe.value;
+            resolve(probe.offset);
+        } else if (res.result == -2) {
+            return failed();
+        } else {
+            slots[probe.offset].missed.set(probe.value);
+        }
+    }
+
+    drain();
+    return size;
+}
+
+void Flasher::confirmData(const std::shared_ptr<HID::Device>& dev, uint32_t address, const uint8_t* predicted, uint32_t size, bool* known)
+{
+    // Spans longer than a verify report takes are confirmed piece by piece
+    const uint32_t limit = PAYLOAD_SIZE - 8;
+    if (size > limit) {
+        for (uint32_t offset = 0; offset < size; offset += limit) {
+            confirmData(dev, address + offset, predicted + offset, std::min(limit, size - offset), known + offset);
         }
 
-        return ret;
+        return;
     }
 
-    return {};
+    std::array<uint8_t, PAYLOAD_SIZE> request;
+    const uint8_t header[] = {
+        _byte(address), _byte(address >> 8U), _byte(address >> 16U), _byte(address >> 24U),
+        _byte(size), _byte(size >> 8U), _byte(size >> 16U), _byte(size >> 24U),
+    };
+
+    std::copy(header, header + sizeof(header), request.begin());
+    std::copy(predicted, predicted + size, request.begin() + sizeof(header));
+    auto res = sendResult(dev, CMD_VERIFY, {request.data(), sizeof(header) + size});
+    ++mStats.probes;
+    if (res.address != address) {
+        return;
+    }
+
+    if (res.result >= 0) {
+        std::fill(known, known + size, true);
+    } else if (size > 1) {
+        confirmData(dev, address, predicted, size / 2, known);
+        confirmData(dev, address + size / 2, predicted + size / 2, size - size / 2, known + size / 2);
+    }
 }
 
 bool Flasher::writeData(uint32_t address, const std::vector<uint8_t>& data, bool encrypted)
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
+    auto bootDev = mBoot.device();
+    if (!!bootDev) {
         ext::BufferStream stream;
         stream.appendDword(address);
         stream.appendDword(data.size());
@@ -234,79 +857,167 @@ bool Flasher::writeData(uint32_t address, const std::vector<uint8_t>& data, bool
     return false;
 }
 
-bool Flasher::decode(const FlashFile& file)
+ext::BufferView Flasher::send(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, ext::BufferView data)
 {
-    auto bootDev = HID::find(GB_VID, GB_BOOT_PID);
-    if (!!bootDev && bootDev->open()) {
-        for (const auto& c: file.cmds(MemoryInfo::APPLICATION)) {
-            const auto& p = c.second;
-            if (!p.encrypted) {
-                continue;
-            }
+    mReceived = mPosted;
+    return exchange(dev, cmd, post(dev, cmd, data));
+}
 
-            auto d = readData(p.address, p.length());
-            if (d.empty()) {
-                Logger::error<Flasher>("decode") ("Failed reading address %08X", p.address);
-                return false;
-            }
+ext::BufferView Flasher::sendRecord(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, const FlashFile::Record& f)
+{
+    mReceived = mPosted;
+    return exchange(dev, cmd, postRecord(dev, cmd, f));
+}
+
+Flasher::AddressResult Flasher::sendResult(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, ext::BufferView data)
+{
+    return toResult(send(dev, cmd, data));
+}
+
+ext::BufferView Flasher::exchange(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, bool posted)
+{
+    if (!posted) {
+        Logger::verbose<Flasher>("send") << "write failed";
+        mBoot.invalidate();
+        return {};
+    }
 
-            ext::BufferStream stream;
-            stream.append(static_cast<uint8_t>(p.length()));
-            stream.append(static_cast<uint8_t>((p.address >> 8) & 0xFFU));
-            stream.append(static_cast<uint8_t>((p.address) & 0xFFU));
-            stream.append(static_cast<uint8_t>(0x00U));
-            stream.append(d);
-            auto check = FlashFile::calculateChecksum(stream.data());
-            stream.append(check);
+    // Bootloaders that don't know CMD_GET_DATA never answer it, don't sit out every retransmit to find out
+    bool retry = idempotent(cmd) && (cmd != CMD_GET_DATA || mGetData);
+    auto ret = receive(dev, cmd);
+    for (uint32_t i = 0; ret.empty() && mTimedOut && i < MAX_RETRANSMITS && retry; ++i) {
+        if (!retransmit(dev)) {
+            break;
+        }
 
-            std::cout << ":" << utils::Hex::toString(stream.data()) << "\n";
+        ret = receive(dev, cmd);
+        if (!ret.empty()) {
+            // The earlier copies may only have been answered late, their replies are dropped as they turn up
+            mStaleLen = ret.size() + 1;
+            std::copy(mReply.begin(), mReply.begin() + mStaleLen, mStale.begin());
+            mStaleReplies = i + 1;
         }
+    }
 
-        return true;
+    mRetransmitted = false;
+    if (ret.empty()) {
+        Logger::verbose<Flasher>("send") << "read failed";
+        mBoot.invalidate();
     }
 
-    return false;
+    return ret;
 }
 
-std::vector<uint8_t> Flasher::send(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, std::vector<uint8_t> data)
+bool Flasher::post(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, ext::BufferView data)
 {
-    std::vector<uint8_t> write;
-    write.emplace_back(cmd);
-    std::copy(data.begin(), data.end(), std::back_inserter(write));
-    if (!dev->write(write)) {
-        Logger::verbose<Flasher>("send") << "write failed";
-        return {};
+    if (data.size() > mRequest.size() - 2) {
+        Logger::error<Flasher>("post") << "Data size" << data.size() << "exceeds maximum packet size";
+        return false;
     }
 
-    ext::BufferStream stream(dev->read());
-    if (stream.eof()) {
-        Logger::verbose<Flasher>("send") << "read failed";
+    std::copy(data.data(), data.data() + data.size(), mRequest.begin() + 2);
+    return postRequest(dev, cmd, data.size());
+}
+
+bool Flasher::postRecord(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, const FlashFile::Record& f)
+{
+    // Encode straight into the report so records are sent without intermediate buffers
+    auto len = f.encode(&mRequest[2], mRequest.size() - 2);
+    if (len == 0) {
+        Logger::error<Flasher>("postRecord") ("Record at %08X exceeds maximum packet size", f.address);
+        return false;
+    }
+
+    return postRequest(dev, cmd, len);
+}
+
+bool Flasher::postRequest(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, size_t len)
+{
+    mRequest[0] = REPORT_NORMAL;
+    mRequest[1] = cmd;
+    std::fill(mRequest.begin() + 2 + len, mRequest.end(), 0x00U);
+    if (!dev->write(mRequest)) {
+        return false;
+    }
+
+    mSent[mPosted++ % mSent.size()] = std::chrono::steady_clock::now();
+    mRetransmitted = false;
+    ++mStats.requests;
+    return true;
+}
+
+bool Flasher::retransmit(const std::shared_ptr<HID::Device>& dev)
+{
+    // The request is still in the buffer, mPosted already accounts for it
+    Logger::warning<Flasher>("retransmit") ("Retransmitting %02X", mRequest[1]);
+    if (!dev->write(mRequest)) {
+        return false;
+    }
+
+    ++mStats.retransmits;
+    mSent[(mPosted - 1) % mSent.size()] = std::chrono::steady_clock::now();
+    --mReceived;
+    mRetransmitted = true;
+    return true;
+}
+
+ext::BufferView Flasher::receive(const std::shared_ptr<HID::Device>& dev, uint8_t cmd)
+{
+    auto& estimator = rtt(cmd);
+    auto sent = mSent[mReceived++ % mSent.size()];
+    auto remaining = [&]() {
+        auto elapsed = std::chrono::steady_clock::now() - sent;
+        return static_cast<int>(std::max<int64_t>(0, (estimator.timeout() - std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)).count()));
+    };
+
+    auto len = dev->read(mReply, remaining());
+    while (len > 0 && mStaleReplies > 0 && static_cast<size_t>(len) == mStaleLen && std::equal(mStale.begin(), mStale.begin() + len, mReply.begin())) {
+        Logger::verbose<Flasher>("receive") ("Dropped late reply to %02X", mReply[0]);
+        --mStaleReplies;
+        len = dev->read(mReply, remaining());
+    }
+
+    mTimedOut = (len == 0);
+    if (mTimedOut) {
+        ++mStats.timeouts;
+        Logger::warning<Flasher>("receive") ("No reply to %02X within %u ms", cmd, static_cast<uint32_t>(estimator.timeout().count()));
+        estimator.backoff();
         return {};
     }
 
-    if (stream.readUInt8() != cmd) {
+    // Karn's rule, a reply to a resent request can't tell which copy it answers
+    if (len > 0 && !mRetransmitted) {
+        estimator.sample(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent));
+    }
+
+    if (len <= 1 || mReply[0] != cmd) {
         return {};
     }
 
-    return stream.readBytes();
+    return {mReply.data() + 1, static_cast<size_t>(len - 1)};
 }
 
-Flasher::AddressResult Flasher::sendResult(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, std::vector<uint8_t> data)
+Flasher::AddressResult Flasher::receiveResult(const std::shared_ptr<HID::Device>& dev, uint8_t cmd)
 {
-    ext::BufferStream stream(send(dev, cmd, data));
-    if (stream.eof()) {
+    return toResult(receive(dev, cmd));
+}
+
+Flasher::AddressResult Flasher::toResult(ext::BufferView data)
+{
+    if (data.empty()) {
         return {0U, -1};
     }
 
-    return {stream.readUInt32(), static_cast<int32_t>(stream.readUInt32())};
+    auto address = data.readUInt32();
+    return {address, static_cast<int32_t>(data.readUInt32())};
 }
 
-std::vector<uint8_t> Flasher::readSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, std::vector<uint8_t> data)
+std::vector<uint8_t> Flasher::readSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cmd)
 {
     uint16_t readSize = 0, totalSize = 0xFFFFU;
     std::map<uint8_t, std::vector<uint8_t>> blockData;
     while (totalSize == 0xFFFFU || readSize < totalSize) {
-        ext::BufferStream stream(send(dev, cmd, data));
+        auto stream = send(dev, cmd);
         if (stream.eof()) {
             break;
         }
@@ -325,7 +1036,7 @@ std::vector<uint8_t> Flasher::readSegmented(const std::shared_ptr<HID::Device>&
         auto blkSize = stream.readUInt8();
         auto blkIndex = stream.readUInt8();
 
-        blockData[blkIndex] = stream.readBytes(blkSize);
+        blockData[blkIndex] = stream.readView(blkSize).toVector();
         readSize += blkSize;
     }
 
@@ -340,6 +1051,20 @@ std::vector<uint8_t> Flasher::readSegmented(const std::shared_ptr<HID::Device>&
 
 bool Flasher::writeSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cmd, uint32_t address, const std::vector<uint8_t>& data)
 {
+    for (const auto& segment: segments(address, data)) {
+        auto r = send(dev, cmd, segment);
+        if (r.empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::vector<std::vector<uint8_t>> Flasher::segments(uint32_t address, const std::vector<uint8_t>& data)
+{
+    std::vector<std::vector<uint8_t>> ret;
+
     // 54 = 64 (block size) - 10 (header size)
     for (uint8_t i = 0; i < std::ceil(data.size() / 54.0f); ++i) {
         uint32_t start = i * 54;
@@ -355,27 +1080,48 @@ bool Flasher::writeSegmented(const std::shared_ptr<HID::Device>& dev, uint8_t cm
             stream.fill(54 - size, 0x00U);
         }
 
-        auto r = send(dev, cmd, stream.data());
-        if (r.empty()) {
-            return false;
-        }
+        ret.push_back(stream.data());
     }
 
-    return true;
+    return ret;
 }
 
 bool Flasher::waitMode(uint8_t mode)
 {
+    auto& session = (mode == MODE_BOOT) ? mBoot : mRegular;
+    auto pid = (mode == MODE_BOOT) ? GB_BOOT_PID : GB_PID;
+    auto interfaceNum = (mode == MODE_BOOT) ? -1 : 1;
+
+#ifdef __linux__
+    auto& hotplug = Hotplug::instance();
+    bool events = hotplug.start();
+#else
+    bool events = false;
+#endif
+
     auto timeout = ext::Timer::sec(10);
+    bool added = false;
     do {
-        // Wait for the boot device to become available
-        auto dev = HID::find(GB_VID, (mode == MODE_BOOT) ? GB_BOOT_PID : GB_PID, (mode == MODE_BOOT) ? -1 : 1);
-        if (!!dev && dev->open()) {
+        using namespace std::chrono_literals;
+#ifdef __linux__
+        auto generation = hotplug.generation();
+#endif
+
+        // Wait for the device to become available, the session keeps it open for later use
+        if (!!session.device()) {
             return true;
         }
 
-        using namespace std::chrono_literals;
-        std::this_thread::sleep_for(10ms);
+        // Once the node showed up it may still take udev a moment to make it accessible
+        if (!events || added) {
+            std::this_thread::sleep_for(10ms);
+            continue;
+        }
+
+#ifdef __linux__
+        // Sleep until the device node shows up, retrying now and then in case an event got lost
+        added = hotplug.wait(GB_VID, pid, interfaceNum, generation, 250ms);
+#endif
     } while (!timeout.expired());
 
     Logger::error<Flasher>("waitMode") << "waiting for" << (mode == MODE_BOOT ? "boot" : "regular") << "mode failed";
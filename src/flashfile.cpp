@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
 #include "ext/bufferstream.h"
+#include "ext/mappedfile.h"
 #include "flashfile.h"
 #include "logger.h"
 #include "utils/hex.h"
@@ -12,45 +19,278 @@ std::vector<uint8_t> FlashFile::Command::encoded() const
     return stream.data();
 }
 
+size_t FlashFile::Command::encode(uint8_t* dst, size_t size) const
+{
+    return Record(*this).encode(dst, size);
+}
+
+FlashFile::Record::Record(const Command& c)
+    : address(c.address)
+    , cmd(c.cmd)
+    , encrypted(c.encrypted)
+    , padding(c.padding)
+    , size(static_cast<uint8_t>(c.data.size()))
+    , data(c.data.data())
+{}
+
+size_t FlashFile::Record::encode(uint8_t* dst, size_t capacity) const
+{
+    size_t len = 8 + size;
+    if (len > capacity) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        dst[i] = static_cast<uint8_t>(address >> (i * 8U));
+        dst[4 + i] = static_cast<uint8_t>(static_cast<uint32_t>(size) >> (i * 8U));
+    }
+
+    std::copy(data, data + size, dst + 8);
+    return len;
+}
+
+FlashFile::FlashFile(const std::string& path, const DeviceInfo& deviceInfo)
+{
+    ext::MappedFile file(path);
+    if (file.missing()) {
+        Logger::error<FlashFile>("FlashFile") << path << "does not exist";
+    }
+
+    if (!file) {
+        return;
+    }
+
+    load(file.data(), file.size(), deviceInfo);
+}
+
 FlashFile::FlashFile(std::ifstream stream, const DeviceInfo& deviceInfo)
 {
+    std::string data(std::istreambuf_iterator<char>(stream), {});
+    load(data.data(), data.size(), deviceInfo);
+}
+
+void FlashFile::load(const char* data, size_t size, const DeviceInfo& deviceInfo)
+{
+    if (!parse(data, size, deviceInfo)) {
+        return;
+    }
+
+    mValid = !!mAppInfo && !mRecords.empty();
+    Logger::verbose<FlashFile>("load") ("%u pages, %u bytes of ciphertext, %u KB held", static_cast<uint32_t>(mImage.pages().size()),
+        static_cast<uint32_t>(mCipher.size()), static_cast<uint32_t>((mImage.footprint() + mCipher.capacity()) / 1024));
+}
+
+bool FlashFile::parse(const char* data, size_t size, const DeviceInfo& deviceInfo)
+{
+    // Split at line boundaries into a chunk per core, each at least PARALLEL_CHUNK bytes
+    const char* end = data + size;
+    size_t count = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), size / PARALLEL_CHUNK));
+    std::vector<Chunk> chunks(count);
+    const char* p = data;
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].begin = p;
+        if (i + 1 < count) {
+            const char* split = data + size * (i + 1) / count;
+            const char* eol = static_cast<const char*>(memchr(split, '\n', end - split));
+            p = (eol != nullptr) ? eol + 1 : end;
+        } else {
+            p = end;
+        }
+
+        chunks[i].end = p;
+    }
+
+    // Extended linear address records are the only state carried from line to line, so each chunk
+    // starts from the last one found before it
     uint32_t baseAddr = 0;
-    std::string line;
-    while (std::getline(stream, line)) {
-        if (line.empty() || line[0] == '#') {
+    for (auto& c: chunks) {
+        c.baseAddr = baseAddr;
+        baseAddr = lastBaseAddress(c.begin, c.end, baseAddr);
+    }
+
+    if (count == 1) {
+        chunks[0].ok = parseChunk(chunks[0], deviceInfo);
+    } else {
+        std::vector<std::thread> workers;
+        for (auto& c: chunks) {
+            workers.emplace_back([&c, &deviceInfo]() {
+                c.ok = parseChunk(c, deviceInfo);
+            });
+        }
+
+        for (auto& w: workers) {
+            w.join();
+        }
+    }
+
+    // Merged in file order so the first record for an address wins, as when parsing in one go
+    Records records;
+    for (auto& c: chunks) {
+        if (!c.ok) {
+            return false;
+        }
+
+        for (auto& r: c.records) {
+            records[r.first].push_back(r.second);
+        }
+    }
+
+    for (auto& t: records) {
+        auto& v = t.second;
+        if (!std::is_sorted(v.begin(), v.end(), [](const Record& a, const Record& b) { return a.address < b.address; })) {
+            std::stable_sort(v.begin(), v.end(), [](const Record& a, const Record& b) { return a.address < b.address; });
+        }
+
+        v.erase(std::unique(v.begin(), v.end(), [](const Record& a, const Record& b) { return a.address == b.address; }), v.end());
+        v.shrink_to_fit();
+    }
+
+    store(std::move(records));
+    return true;
+}
+
+void FlashFile::store(Records records)
+{
+    auto appInfo = records.find(MemoryInfo::APPINFO);
+    if (appInfo != records.end()) {
+        std::vector<uint8_t> appdata;
+        for (const auto& r: appInfo->second) {
+            appdata.insert(appdata.end(), r.data, r.data + r.size);
+        }
+
+        if (!appdata.empty()) {
+            mAppInfo = std::make_shared<AppInfo>(appdata);
+        }
+
+        // App info is set using a separate command
+        records.erase(appInfo);
+    }
+
+    // Reserved so the ciphertext doesn't move while records are pointed at it
+    size_t cipher = 0;
+    for (const auto& t: records) {
+        for (const auto& r: t.second) {
+            cipher += r.encrypted ? r.size : 0;
+        }
+    }
+
+    mCipher.reserve(cipher);
+    for (auto& t: records) {
+        for (auto& r: t.second) {
+            if (r.encrypted) {
+                const uint8_t* p = mCipher.data() + mCipher.size();
+                mCipher.insert(mCipher.end(), r.data, r.data + r.size);
+                r.data = p;
+            } else {
+                mImage.write(r.address, r.data, r.size);
+            }
+        }
+    }
+
+    // Once compacted every written range is contiguous
+    mImage.compact();
+    for (auto& t: records) {
+        for (auto& r: t.second) {
+            if (!r.encrypted) {
+                r.data = mImage.at(r.address, r.size);
+            }
+        }
+    }
+
+    mRecords = std::move(records);
+}
+
+uint32_t FlashFile::lastBaseAddress(const char* begin, const char* end, uint32_t baseAddr)
+{
+    static const char pattern[] = ":02000004";
+    const size_t len = sizeof(pattern) - 1;
+    for (const char* p = begin; p + len + 4 <= end; ++p) {
+        p = static_cast<const char*>(memchr(p, ':', end - p));
+        if (p == nullptr || p + len + 4 > end) {
+            break;
+        }
+
+        uint8_t addr[2];
+        if ((p == begin || p[-1] == '\n') && memcmp(p, pattern, len) == 0 && utils::Hex::decode(p + len, sizeof(addr), addr)) {
+            baseAddr = static_cast<uint32_t>((addr[0] << 8U) | addr[1]) << 16U;
+        }
+    }
+
+    return baseAddr;
+}
+
+FlashFile::Reader::Reader(const char* begin, const char* end, uint32_t baseAddr, const DeviceInfo& deviceInfo)
+    : mPos(begin)
+    , mEnd(end)
+    , mBaseAddr(baseAddr)
+    , mDeviceInfo(deviceInfo)
+{}
+
+bool FlashFile::Reader::next(MemoryInfo::Type& type, Command& cmd)
+{
+    // Records are decoded where they lie, payloads go straight into their command
+    while (mPos < mEnd) {
+        const char* eol = static_cast<const char*>(memchr(mPos, '\n', mEnd - mPos));
+        if (eol == nullptr) {
+            eol = mEnd;
+        }
+
+        const char* line = mPos;
+        const char* last = eol;
+        mPos = (eol < mEnd) ? eol + 1 : mEnd;
+        while (last > line && isspace(static_cast<unsigned char>(last[-1]))) {
+            --last;
+        }
+
+        if (last == line || line[0] == '#') {
             continue;
         }
 
-        if (line[0] != ':') {
-            return;
+        // Length, address (2), type, data and checksum, which brings the sum of all bytes to zero
+        uint8_t header[4];
+        uint8_t sum = 0;
+        if (line[0] != ':' || last - line < 11 || !utils::Hex::decode(line + 1, sizeof(header), header, sum)) {
+            return fail();
         }
 
-        auto data = utils::Hex::fromString(line.substr(1));
-        if (!verifyChecksum(data)) {
-            Logger::error<FlashFile>("FlashFile") << "Found invalid checksum at line" << line;
-            return;
+        uint8_t len = header[0];
+        if (last - line != 11 + len * 2) {
+            Logger::error<FlashFile>("FlashFile") << "Invalid record length at line" << std::string(line, last);
+            return fail();
         }
 
-        ext::BufferStream lineStream(data);
-        if (lineStream.eof()) {
-            return;
+        // Reassigned field by field so a command reused across calls keeps its buffer
+        cmd.address = static_cast<uint32_t>((header[1] << 8U) | header[2]);
+        cmd.cmd = header[3];
+        cmd.encrypted = false;
+        cmd.padding = 0;
+        uint8_t ext[2];
+        uint8_t* payload = ext;
+        if (cmd.cmd == 0x04U) {
+            if (len != sizeof(ext)) {
+                return fail();
+            }
+        } else {
+            cmd.data.resize(len);
+            payload = cmd.data.data();
         }
 
-        FlashFile::Command cmd({0, 0, {}, false, 0});
-        auto len = lineStream.readUInt8();
-        cmd.address = lineStream.bitRead(16);   // Little endian
-        cmd.cmd = lineStream.readUInt8();
-        cmd.data = lineStream.readBytes(len);
-        auto chk = lineStream.readUInt8();
+        uint8_t chk;
+        if (!utils::Hex::decode(line + 9, len, payload, sum) || !utils::Hex::decode(line + 9 + len * 2, 1, &chk, sum)) {
+            return fail();
+        }
+
+        if (sum != 0) {
+            Logger::error<FlashFile>("FlashFile") << "Found invalid checksum at line" << std::string(line, last);
+            return fail();
+        }
 
         switch (cmd.cmd) {
             case 0x00U: {
                 break;
             }
             case 0x04U: {
-                ext::BufferStream addrData(cmd.data);
-                baseAddr = addrData.bitRead(16);
-                baseAddr <<= 16;
+                mBaseAddr = static_cast<uint32_t>((ext[0] << 8U) | ext[1]) << 16U;
                 continue;
             }
             default: {
@@ -61,37 +301,106 @@ FlashFile::FlashFile(std::ifstream stream, const DeviceInfo& deviceInfo)
                     break;
                 }
 
-                return;
+                return fail();
             }
         }
 
-        cmd.address |= baseAddr;
+        cmd.address |= mBaseAddr;
         cmd.address &= 0x1FFFFFFF;
 
-        auto memType = deviceInfo.memoryType(cmd.address, cmd.data.size());
-        Logger::verbose<FlashFile>("FlashFile")("cmd %02X, addr %08X, len %08X, type %d", cmd.cmd, cmd.address, cmd.data.size(), memType);
-        if (memType == MemoryInfo::NONE) {
-            return;
+        type = mDeviceInfo.memoryType(cmd.address, cmd.data.size());
+        Logger::verbose<FlashFile>("FlashFile")("cmd %02X, addr %08X, len %08X, type %d", cmd.cmd, cmd.address, cmd.data.size(), type);
+        if (type == MemoryInfo::NONE) {
+            return fail();
         }
 
-        mCommands[memType].insert({cmd.address, cmd});
+        return true;
     }
 
-    if (mCommands.find(MemoryInfo::APPINFO) != mCommands.end()) {
-        std::vector<uint8_t> appdata;
-        for (const auto& p: mCommands.at(MemoryInfo::APPINFO)) {
-            std::copy(p.second.data.begin(), p.second.data.end(), std::back_inserter(appdata));
+    return false;
+}
+
+bool FlashFile::Reader::fail()
+{
+    mOk = false;
+    mPos = mEnd;
+    return false;
+}
+
+bool FlashFile::parseChunk(Chunk& chunk, const DeviceInfo& deviceInfo)
+{
+    // Payloads never take more than half the text they are decoded from
+    chunk.bytes.reserve((chunk.end - chunk.begin) / 2);
+    Reader reader(chunk.begin, chunk.end, chunk.baseAddr, deviceInfo);
+    MemoryInfo::Type type;
+    Command cmd;
+    while (reader.next(type, cmd)) {
+        Record r(cmd);
+        r.data = chunk.bytes.data() + chunk.bytes.size();
+        chunk.bytes.insert(chunk.bytes.end(), cmd.data.begin(), cmd.data.end());
+        chunk.records.emplace_back(type, r);
+    }
+
+    return reader.ok();
+}
+
+std::vector<FlashFile::Record> FlashFile::coalesce(const std::vector<Record>& records, size_t capacity, std::vector<uint8_t>& scratch)
+{
+    // Each piece keeps the 2 byte trailer a plaintext record carries and starts a whole number of words
+    // after the previous one
+    const uint32_t stride = static_cast<uint32_t>(std::min<size_t>(capacity - 8, 0xFFU) - 2) & ~3U;
+    auto mergeable = [](const Record& r) { return !r.encrypted && r.size >= 2; };
+
+    size_t total = 0;
+    for (const auto& r: records) {
+        total += r.size;
+    }
+
+    scratch.clear();
+    scratch.reserve(total);
+
+    std::vector<Record> ret;
+    ret.reserve(records.size());
+    for (size_t i = 0; i < records.size();) {
+        size_t j = i + 1;
+        bool inPlace = true;
+        if (mergeable(records[i])) {
+            while (j < records.size() && mergeable(records[j]) && records[j].address == records[j - 1].address + records[j - 1].length()) {
+                inPlace = inPlace && records[j].data == records[j - 1].data + records[j - 1].length();
+                ++j;
+            }
         }
 
-        if (!appdata.empty()) {
-            mAppInfo = std::make_shared<AppInfo>(appdata);
+        if (j == i + 1) {
+            ret.push_back(records[i]);
+            i = j;
+            continue;
         }
 
-        // App info is set using a separate command
-        mCommands.erase(MemoryInfo::APPINFO);
+        const uint8_t* bytes = records[i].data;
+        if (!inPlace) {
+            bytes = scratch.data() + scratch.size();
+            for (size_t k = i; k + 1 < j; ++k) {
+                scratch.insert(scratch.end(), records[k].data, records[k].data + records[k].length());
+            }
+
+            scratch.insert(scratch.end(), records[j - 1].data, records[j - 1].data + records[j - 1].size);
+        }
+
+        const uint32_t start = records[i].address;
+        const uint32_t end = records[j - 1].address + records[j - 1].length();
+        for (uint32_t a = start; a < end; a += stride) {
+            Record r = records[i];
+            r.address = a;
+            r.size = static_cast<uint8_t>(std::min(stride, end - a) + 2);
+            r.data = bytes + (a - start);
+            ret.push_back(r);
+        }
+
+        i = j;
     }
 
-    mValid = !!mAppInfo && !mCommands.empty();
+    return ret;
 }
 
 uint8_t FlashFile::calculateChecksum(const std::vector<uint8_t>& data, uint32_t size)
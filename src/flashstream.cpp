@@ -0,0 +1,87 @@
+#include <map>
+#include <vector>
+
+#include "flashstream.h"
+#include "logger.h"
+
+FlashStream::FlashStream(const std::string& path, const DeviceInfo& deviceInfo, size_t depth)
+    : mFile(path)
+    , mDeviceInfo(deviceInfo)
+    , mQueue(depth)
+{}
+
+FlashStream::~FlashStream()
+{
+    stop();
+}
+
+void FlashStream::start()
+{
+    stop();
+    mQueue.reset();
+    mOk = false;
+    mAppInfo.reset();
+    mStarted = std::chrono::steady_clock::now();
+    mFirstRecord = std::chrono::microseconds(0);
+    mProducer = std::thread(&FlashStream::produce, this);
+}
+
+void FlashStream::stop()
+{
+    if (mProducer.joinable()) {
+        mQueue.close();
+        mProducer.join();
+    }
+}
+
+bool FlashStream::next(MemoryInfo::Type& type, FlashFile::Command& cmd)
+{
+    Record r;
+    if (!mQueue.pop(r)) {
+        // The producer is done, its results can be read without racing it
+        stop();
+        return false;
+    }
+
+    if (mFirstRecord.count() == 0) {
+        mFirstRecord = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStarted);
+    }
+
+    type = r.first;
+    cmd = std::move(r.second);
+    return true;
+}
+
+void FlashStream::produce()
+{
+    FlashFile::Reader reader(mFile.data(), mFile.data() + mFile.size(), 0, mDeviceInfo);
+    std::map<uint32_t, std::vector<uint8_t>> appInfo;
+    Record r;
+    while (reader.next(r.first, r.second)) {
+        if (r.first == MemoryInfo::APPINFO) {
+            // App info is set using a separate command once everything else is written
+            appInfo.emplace(r.second.address, std::move(r.second.data));
+            continue;
+        }
+
+        if (!mQueue.push(std::move(r))) {
+            return;
+        }
+    }
+
+    std::vector<uint8_t> appdata;
+    for (const auto& p: appInfo) {
+        appdata.insert(appdata.end(), p.second.begin(), p.second.end());
+    }
+
+    if (!appdata.empty()) {
+        mAppInfo = std::make_shared<AppInfo>(appdata);
+    }
+
+    mOk = reader.ok() && !!mAppInfo;
+    if (!reader.ok()) {
+        Logger::error<FlashStream>("produce") << "Stopped at an invalid record";
+    }
+
+    mQueue.close();
+}
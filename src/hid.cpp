@@ -1,9 +1,20 @@
+#include <algorithm>
 #include <cstdio>
 
 #include "hid.h"
 #include "logger.h"
+#include "trace.h"
 #include "utils/hex.h"
 
+#ifdef __linux__
+#include "hidraw.h"
+#endif
+
+std::mutex HID::sMutex;
+std::shared_ptr<HID::Bus> HID::sBus;
+HID::Backend HID::sBackend = HID::BACKEND_HIDAPI;
+std::shared_ptr<Trace> HID::sTrace;
+
 HID::Device::Device(std::string path)
     : mPath(std::move(path))
 {}
@@ -33,61 +44,108 @@ void HID::Device::close()
     }
 }
 
-std::vector<uint8_t> HID::Device::read()
+int HID::Device::read(Report& report, int timeout)
 {
-    if (mDevice == nullptr) {
-        return {};
+    if (!isOpen()) {
+        return -1;
     }
 
-    std::vector<uint8_t> ret(65, 0x0U);
-    auto read = hid_read_timeout(mDevice, &ret.at(0), ret.size(), 10000);
-    if (read <= 0) {
+    auto read = readReport(report.data(), report.size(), timeout);
+    if (read == 0) {
+        Logger::verbose<HID::Device>("read") << "timed out after" << timeout << "ms";
+        return read;
+    }
+
+    if (read < 0) {
         Logger::error<HID::Device>("read") << "error" << read;
+        return read;
+    }
+
+    if (Logger::isVerbose()) {
+        Logger::verbose<HID::Device>("read") << "result" << utils::Hex::toString(report.data(), read);
+    }
+
+    if (!!sTrace) {
+        sTrace->append(Trace::DIR_IN, report.data(), read);
+    }
+
+    return read;
+}
+
+std::vector<uint8_t> HID::Device::read()
+{
+    Report report;
+    auto len = read(report);
+    if (len <= 0) {
         return {};
     }
 
-    ret.resize(read);
-    Logger::verbose<HID::Device>("read") << "result" << utils::Hex::toString(ret);
-    return ret;
+    return std::vector<uint8_t>(report.begin(), report.begin() + len);
 }
 
-bool HID::Device::write(uint8_t report, const std::vector<uint8_t>& data)
+bool HID::Device::write(const Report& report)
 {
-    if (mDevice == nullptr) {
+    if (!isOpen()) {
         Logger::error<HID::Device>() << "No device opened";
         return false;
     }
 
+    if (Logger::isVerbose()) {
+        Logger::verbose<HID>("write") << utils::Hex::toString(report.data(), report.size());
+    }
+
+    if (!!sTrace) {
+        sTrace->append(Trace::DIR_OUT, report.data(), report.size());
+    }
+
+    return writeReport(report.data(), report.size()) == static_cast<int>(report.size());
+}
+
+bool HID::Device::write(uint8_t report, const std::vector<uint8_t>& data)
+{
     if (data.size() > 64) {
         Logger::error<HID::Device>() << "Data size" << data.size() << "exceeds maximum packet size";
         return false;
     }
 
-    std::vector<uint8_t> d(65, 0x00U);
-    d[0] = report;
-    if (!data.empty()) {
-        std::copy(data.begin(), data.end(), d.begin() + 1);
-    }
+    Report r{};
+    r[0] = report;
+    std::copy(data.begin(), data.end(), r.begin() + 1);
+    return write(r);
+}
 
-    Logger::verbose<HID>("write") << utils::Hex::toString(d);
-    return hid_write(mDevice, d.data(), d.size()) == d.size();
+int HID::Device::readReport(uint8_t* data, size_t size, int timeout)
+{
+    return hid_read_timeout(mDevice, data, size, timeout);
 }
 
-std::shared_ptr<HID::Device> HID::find(uint16_t vid, uint16_t pid, int interfaceNum)
+int HID::Device::writeReport(const uint8_t* data, size_t size)
 {
+    return hid_write(mDevice, data, size);
+}
+
+std::vector<HID::Entry> HID::enumerate(uint16_t vid, uint16_t pid, int interfaceNum)
+{
+    // hidapi's enumeration isn't safe to run from several threads at once
+    std::unique_lock<std::mutex> lock(sMutex);
+    if (!!sBus) {
+        return sBus->enumerate(vid, pid, interfaceNum);
+    }
+
     auto* devs = hid_enumerate(vid, pid);
     auto* cur_dev = devs;
 
-    std::string path;
+    std::vector<Entry> ret;
     while (cur_dev != nullptr) {
         if (cur_dev->vendor_id == vid && cur_dev->product_id == pid && (interfaceNum == -1 || cur_dev->interface_number == interfaceNum)) {
-            Logger::verbose<HID>("find") ("Found %04X:%04X (interface %d), path %s", cur_dev->vendor_id, cur_dev->product_id, cur_dev->interface_number, cur_dev->path);
-            if (!path.empty()) {
-                Logger::warning<HID::Device>("find") << "Multiple devices match, using first";
-                break;
+            Logger::verbose<HID>("enumerate") ("Found %04X:%04X (interface %d), path %s", cur_dev->vendor_id, cur_dev->product_id, cur_dev->interface_number, cur_dev->path);
+
+            std::string serial;
+            for (auto* c = cur_dev->serial_number; c != nullptr && *c != 0; ++c) {
+                serial += (*c < 0x80) ? static_cast<char>(*c) : '?';
             }
 
-            path = cur_dev->path;
+            ret.push_back({cur_dev->path, serial});
         }
 
         cur_dev = cur_dev->next;
@@ -97,9 +155,56 @@ std::shared_ptr<HID::Device> HID::find(uint16_t vid, uint16_t pid, int interface
         hid_free_enumeration(devs);
     }
 
-    if (!path.empty()) {
-        return std::make_shared<Device>(path);
+    return ret;
+}
+
+std::shared_ptr<HID::Device> HID::find(uint16_t vid, uint16_t pid, int interfaceNum, const std::string& serial)
+{
+    std::string path;
+    for (const auto& e: enumerate(vid, pid, interfaceNum)) {
+        if (!serial.empty() && e.serial != serial) {
+            continue;
+        }
+
+        if (!path.empty()) {
+            Logger::warning<HID::Device>("find") << "Multiple devices match, using first";
+            break;
+        }
+
+        path = e.path;
+    }
+
+    if (path.empty()) {
+        return nullptr;
+    }
+
+    return create(path);
+}
+
+std::vector<std::shared_ptr<HID::Device>> HID::findAll(uint16_t vid, uint16_t pid, int interfaceNum)
+{
+    std::vector<std::shared_ptr<HID::Device>> ret;
+    for (const auto& e: enumerate(vid, pid, interfaceNum)) {
+        auto dev = create(e.path);
+        if (!!dev) {
+            ret.push_back(dev);
+        }
+    }
+
+    return ret;
+}
+
+std::shared_ptr<HID::Device> HID::create(const std::string& path)
+{
+    if (!!sBus) {
+        return sBus->device(path);
+    }
+
+#ifdef __linux__
+    if (sBackend == BACKEND_HIDRAW) {
+        return std::make_shared<HIDRaw>(path);
     }
+#endif
 
-    return nullptr;
+    return std::make_shared<Device>(path);
 }
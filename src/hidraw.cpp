@@ -0,0 +1,75 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "hidraw.h"
+#include "logger.h"
+
+HIDRaw::HIDRaw(std::string path)
+    : HID::Device(std::move(path))
+{}
+
+HIDRaw::~HIDRaw()
+{
+    close();
+}
+
+bool HIDRaw::open()
+{
+    Logger::verbose<HIDRaw>("open") << path();
+    if (mFd >= 0) {
+        Logger::warning<HIDRaw>("open") << "Already opened";
+        return false;
+    }
+
+    mFd = ::open(path().c_str(), O_RDWR | O_CLOEXEC);
+    if (mFd < 0) {
+        Logger::verbose<HIDRaw>("open") << "failed:" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+void HIDRaw::close()
+{
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+int HIDRaw::readReport(uint8_t* data, size_t size, int timeout)
+{
+    struct pollfd pfd = {mFd, POLLIN, 0};
+    int ret;
+    do {
+        ret = ::poll(&pfd, 1, timeout);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0) {
+        return ret;
+    }
+
+    if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+        return -1;
+    }
+
+    do {
+        ret = ::read(mFd, data, size);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+int HIDRaw::writeReport(const uint8_t* data, size_t size)
+{
+    int ret;
+    do {
+        ret = ::write(mFd, data, size);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
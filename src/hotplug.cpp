@@ -0,0 +1,188 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hotplug.h"
+#include "logger.h"
+
+Hotplug& Hotplug::instance()
+{
+    static Hotplug sInstance;
+    return sInstance;
+}
+
+Hotplug::~Hotplug()
+{
+    if (!!mThread) {
+        char c = 0;
+        if (::write(mStop[1], &c, 1) == 1) {
+            mThread->join();
+        } else {
+            mThread->detach();
+        }
+    }
+
+    for (int fd: {mSocket, mStop[0], mStop[1]}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+bool Hotplug::start()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mStarted) {
+        return mAvailable;
+    }
+
+    mStarted = true;
+    mSocket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (mSocket < 0) {
+        Logger::verbose<Hotplug>("start") << "uevent socket unavailable:" << strerror(errno);
+        return false;
+    }
+
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    // Kernel events come first but the node may not be usable until udev, when it runs, has applied its
+    // rules and sent its own
+    addr.nl_groups = KERNEL_EVENTS | UDEV_EVENTS;
+    if (bind(mSocket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 || pipe2(mStop, O_CLOEXEC) < 0) {
+        Logger::verbose<Hotplug>("start") << "uevent socket unavailable:" << strerror(errno);
+        ::close(mSocket);
+        mSocket = -1;
+        return false;
+    }
+
+    mAvailable = true;
+    mThread = std::make_unique<std::thread>(&Hotplug::process, this);
+    return true;
+}
+
+uint64_t Hotplug::generation()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mGeneration;
+}
+
+bool Hotplug::wait(uint16_t vid, uint16_t pid, int interfaceNum, uint64_t since, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mCond.wait_for(lock, timeout, [&]() {
+        return matches(vid, pid, interfaceNum, since);
+    });
+}
+
+bool Hotplug::matches(uint16_t vid, uint16_t pid, int interfaceNum, uint64_t since) const
+{
+    for (const auto& p: mDevices) {
+        const auto& e = p.second;
+        if (e.generation > since && e.vid == vid && e.pid == pid && (interfaceNum == -1 || e.interfaceNum == interfaceNum)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Hotplug::process()
+{
+    char buf[8192];
+    while (true) {
+        struct pollfd fds[2] = {{mSocket, POLLIN, 0}, {mStop[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        auto len = recv(mSocket, buf, sizeof(buf) - 1, 0);
+        if (len > 0) {
+            buf[len] = '\0';
+            handle(buf, len);
+        }
+    }
+}
+
+void Hotplug::handle(const char* data, size_t size)
+{
+    // Kernel uevents are "action@devpath" followed by NUL separated KEY=value pairs. udev puts the same
+    // pairs behind a binary header starting with "libudev", which says where they are
+    size_t pos = 0;
+    if (size >= UDEV_HEADER && memcmp(data, "libudev", 8) == 0) {
+        uint32_t offset = 0, length = 0;
+        memcpy(&offset, data + 16, sizeof(offset));
+        memcpy(&length, data + 20, sizeof(length));
+        if (offset < UDEV_HEADER || offset > size || length > size - offset) {
+            return;
+        }
+
+        pos = offset;
+        size = offset + length;
+    }
+
+    std::string action, devpath, subsystem;
+    for (; pos < size; pos += strlen(data + pos) + 1) {
+        const char* kv = data + pos;
+        if (strncmp(kv, "ACTION=", 7) == 0) {
+            action = kv + 7;
+        } else if (strncmp(kv, "DEVPATH=", 8) == 0) {
+            devpath = kv + 8;
+        } else if (strncmp(kv, "SUBSYSTEM=", 10) == 0) {
+            subsystem = kv + 10;
+        }
+    }
+
+    if (subsystem != "hidraw" || devpath.empty()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (action == "remove") {
+        mDevices.erase(devpath);
+        return;
+    }
+
+    if (action != "add") {
+        return;
+    }
+
+    // .../1-1:1.0/0003:0782:FFE3.0007/hidraw/hidraw3 holds the interface and the HID ids
+    Entry entry = {0, 0, -1, 0};
+    unsigned int bus = 0, vid = 0, pid = 0, instance = 0;
+    auto hid = devpath.rfind("/hidraw/");
+    auto start = (hid != std::string::npos) ? devpath.rfind('/', hid - 1) : std::string::npos;
+    if (start == std::string::npos || sscanf(devpath.c_str() + start + 1, "%X:%X:%X.%X", &bus, &vid, &pid, &instance) != 4) {
+        return;
+    }
+
+    auto usb = devpath.rfind('/', start - 1);
+    unsigned int config = 0, interfaceNum = 0;
+    if (usb != std::string::npos) {
+        auto colon = devpath.find(':', usb);
+        if (colon != std::string::npos && colon < start && sscanf(devpath.c_str() + colon + 1, "%u.%u", &config, &interfaceNum) == 2) {
+            entry.interfaceNum = interfaceNum;
+        }
+    }
+
+    entry.vid = vid;
+    entry.pid = pid;
+    entry.generation = ++mGeneration;
+    mDevices[devpath] = entry;
+
+    Logger::verbose<Hotplug>("handle") ("Added %04X:%04X (interface %d) at %s", vid, pid, entry.interfaceNum, devpath.c_str());
+    mCond.notify_all();
+}
@@ -1,12 +1,28 @@
+#include <algorithm>
 #include <cctype>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include "emulator.h"
+#ifdef __linux__
+#include "engine.h"
+#endif
+#include "decodecache.h"
+#include "decoder.h"
+#include "dumpwriter.h"
+#include "ext/timer.h"
+#include "flashcache.h"
 #include "flasher.h"
 #include "flashfile.h"
+#include "flashstream.h"
 #include "logger.h"
+#include "replay.h"
+#include "trace.h"
 
 int showUsage()
 {
@@ -15,13 +31,436 @@ int showUsage()
         << "\tgbflasher [options] flash <firmware file>\n"
         << "\tgbflasher [options] reset\n"
         << "\tgbflasher [options] erase\n"
+        << "\tgbflasher [options] decode <firmware file> [output file] - Recover the plaintext of ciphered records\n"
+        << "\tgbflasher [options] dump <address> <length> <file> - Read memory back into a .bin or .hex file\n"
         << "[options]:\n"
         << "-v|--verbose - Verbose logging\n"
         << "-n|--no-reset - Don't reset after flashing\n"
+        << "-w|--window <n> - Number of write reports kept in flight (default 1)\n"
+        << "--probe-window <n> - Number of decode probes kept in flight (default 16)\n"
+        << "-e|--emulate - Run against an emulated bootloader instead of a device\n"
+        << "--latency <us> - Per-report latency of the emulated bootloader\n"
+        << "--backend <hidapi|hidraw> - HID transport to use (default hidapi)\n"
+        << "--units <n> - Number of emulated devices (default 1)\n"
+        << "--if-changed - Leave devices already holding the firmware untouched\n"
+        << "--stream - Start flashing while the firmware file is still being parsed\n"
+        << "--queue <n> - Records parsed ahead of the writes when streaming (default 256)\n"
+        << "--cache <dir> - Keep parsed firmware images and decoded records in dir and reuse them on later runs\n"
+        << "--model <file> - Byte statistics ordering decode probes, updated after every decode\n"
+        << "--reference <file> - Plaintext HEX of an earlier revision, confirmed in place of probing where unchanged\n"
+        << "--capture <file> - Record every report sent and received to a trace file\n"
+        << "--replay <file> - Answer from a recorded trace instead of a device\n"
+        << "--replay-speed <x> - Replay x times faster than recorded, 0 for no delays (default 1)\n"
+        << "-E|--event-loop - Flash every device in boot mode at once from one thread\n"
+        << "-a|--all - Flash every attached device in parallel, or split decoding across devices holding the same image\n"
+        << "-s|--serial <serial> - Only use the device with this serial number\n"
         ;
     return -1;
 }
 
+struct Options {
+    bool noReset = false;
+    uint32_t window = 1;
+    uint32_t probeWindow = 16;
+    bool eventLoop = false;
+    std::string cacheDir;
+    std::string model;
+    std::string reference;
+    bool ifChanged = false;
+    bool stream = false;
+    uint32_t queueDepth = 256;
+};
+
+bool dumpDevice(Flasher& flasher, uint32_t address, uint32_t length, const std::string& path)
+{
+    DumpWriter writer(path, DumpWriter::formatOf(path));
+    if (!writer) {
+        return false;
+    }
+
+    ext::Timer timer;
+    bool ok = flasher.dump(address, length, [&writer](uint32_t a, const uint8_t* data, size_t size) {
+        return writer.write(a, data, size);
+    });
+
+    if (!writer.close() || !ok) {
+        Logger::error("main") ("Failed dumping 0x%08X bytes at 0x%08X", length, address);
+        return false;
+    }
+
+    Logger::info("main") ("Dumped 0x%08X bytes at 0x%08X to %s in %u ms", length, address, path.c_str(), static_cast<uint32_t>(timer.elapsedMs()));
+    return true;
+}
+
+void logStats(const Flasher& flasher)
+{
+    auto stats = flasher.stats();
+    Logger::info("main") ("%u requests, RTT %.2f ms (var %.2f ms, %u samples), timeout %u ms, %u timeouts, %u retransmits", stats.requests,
+        stats.srtt.count() / 1000.0, stats.rttvar.count() / 1000.0, stats.samples, static_cast<uint32_t>(stats.timeout.count()), stats.timeouts, stats.retransmits);
+}
+
+bool flashDevice(Flasher& flasher, const FlashFile& flashFile, const DeviceInfo& deviceInfo, const Options& options)
+{
+    auto appInfo = flasher.appInfo();
+    if (!!appInfo) {
+        Logger::info("main") << "Device app info:" << "App version" << appInfo->appVersion() << ", Bootloader version" << appInfo->bootloaderVersion();
+    }
+
+    ext::Timer timer;
+    // Erasing clears the app info and it is only written back once everything verified, so matching app
+    // info and memory mean an earlier run flashed this exact image. It may have stopped between setting the
+    // app info and signing, so the image is signed again before it is kept.
+    if (options.ifChanged && !!appInfo && *appInfo == *flashFile.appInfo() && flasher.matches(flashFile, deviceInfo) && flasher.sign()) {
+        Logger::info("main") << "Device already holds this firmware, checked in" << timer.elapsedMs() << "ms";
+        if (!options.noReset) {
+            flasher.switchMode(Flasher::MODE_REGULAR);
+        }
+
+        return true;
+    }
+
+    flasher.erase();
+
+    if (!flasher.flash(flashFile, deviceInfo)) {
+        Logger::error("main") << "Failed flashing";
+        return false;
+    }
+
+    if (!flasher.verify(flashFile, deviceInfo)) {
+        Logger::error("main") << "Failed verifying";
+        return false;
+    }
+
+    if (!flasher.setAppInfo(flashFile, deviceInfo, *flashFile.appInfo())) {
+        Logger::error("main") << "Failed flashing app info";
+        return false;
+    }
+
+    auto newAppInfo = flasher.appInfo();
+    if (!!newAppInfo) {
+        Logger::info("main") << "Flashed app info:" << "App version" << newAppInfo->appVersion() << ", Bootloader version" << newAppInfo->bootloaderVersion();
+    }
+
+    Logger::info("main") << "Flashed in" << timer.elapsedMs() << "ms";
+
+    logStats(flasher);
+
+    if (!options.noReset) {
+        flasher.switchMode(Flasher::MODE_REGULAR);
+    }
+
+    return true;
+}
+
+bool streamDevice(Flasher& flasher, const std::string& path, const DeviceInfo& deviceInfo, const Options& options)
+{
+    FlashStream stream(path, deviceInfo, options.queueDepth);
+    if (!stream) {
+        Logger::error("main") << "Failed opening firmware file";
+        return false;
+    }
+
+    ext::Timer timer;
+    // The parser fills the queue while the device erases
+    stream.start();
+    flasher.erase();
+
+    if (!flasher.flash(stream)) {
+        Logger::error("main") << "Failed flashing";
+        return false;
+    }
+
+    Logger::info("main") ("Stream: first record after %.2f ms, queue %u deep (max %u), parser stalled %u times, writer %u times",
+        stream.firstRecord().count() / 1000.0, static_cast<uint32_t>(stream.depth()), static_cast<uint32_t>(stream.maxDepth()), stream.producerStalls(), stream.consumerStalls());
+
+    auto appInfo = stream.appInfo();
+    Logger::info("main") << "Firmware app info:" << "App version" << appInfo->appVersion() << ", Bootloader version" << appInfo->bootloaderVersion();
+
+    stream.start();
+    if (!flasher.verify(stream)) {
+        Logger::error("main") << "Failed verifying";
+        return false;
+    }
+
+    if (!flasher.setAppInfo(deviceInfo, *appInfo)) {
+        Logger::error("main") << "Failed flashing app info";
+        return false;
+    }
+
+    auto newAppInfo = flasher.appInfo();
+    if (!!newAppInfo) {
+        Logger::info("main") << "Flashed app info:" << "App version" << newAppInfo->appVersion() << ", Bootloader version" << newAppInfo->bootloaderVersion();
+    }
+
+    Logger::info("main") << "Flashed in" << timer.elapsedMs() << "ms";
+
+    logStats(flasher);
+
+    if (!options.noReset) {
+        flasher.switchMode(Flasher::MODE_REGULAR);
+    }
+
+    return true;
+}
+
+// Flashes every device in boot mode, or only the one with the given serial number
+int runEngine(const FlashFile& flashFile, const DeviceInfo& deviceInfo, const Options& options, const std::string& serial = {})
+{
+#ifdef __linux__
+    Engine engine(flashFile, deviceInfo, !options.noReset);
+    Logger::info("main") << "Flashing" << engine.addBootDevices(serial) << "devices";
+
+    ext::Timer timer;
+    uint32_t failed = 0;
+    for (const auto& r: engine.run()) {
+        Logger::info("main") ("%s: %s in %llu ms, %u reports, srtt %.2f ms%s%s", r.path.c_str(), r.success ? "done" : "FAILED", static_cast<unsigned long long>(r.ms), r.reports, r.srtt.count() / 1000.0, r.error.empty() ? "" : " - ", r.error.c_str());
+        failed += r.success ? 0 : 1;
+    }
+
+    Logger::info("main") << "Flashed in" << timer.elapsedMs() << "ms," << failed << "failed";
+    return (failed == 0) ? 0 : -1;
+#else
+    Logger::error("main") << "The event loop is only available on Linux";
+    return -1;
+#endif
+}
+
+std::unique_ptr<FlashFile> loadFlashFile(const std::string& path, const DeviceInfo& deviceInfo, const Options& options)
+{
+    ext::Timer timer;
+    auto flashFile = options.cacheDir.empty() ? std::make_unique<FlashFile>(path, deviceInfo) : FlashCache(options.cacheDir).load(path, deviceInfo);
+    if (!flashFile || !*flashFile) {
+        Logger::error("main") << "Failed parsing firmware file";
+        return nullptr;
+    }
+
+    auto flashAppInfo = flashFile->appInfo();
+    if (!flashAppInfo) {
+        Logger::error("main") << "Missing app info in flash file";
+        return nullptr;
+    }
+
+    // Checked before anything is erased
+    if (!deviceInfo.validateFlashFile(*flashFile)) {
+        Logger::error("main") << "Firmware file doesn't match the device memory";
+        return nullptr;
+    }
+
+    Logger::info("main") << "Firmware app info:" << "App version" << flashAppInfo->appVersion() << ", Bootloader version" << flashAppInfo->bootloaderVersion();
+    Logger::verbose("main") << "Loaded" << path << "in" << timer.elapsedUs() << "us";
+    return flashFile;
+}
+
+int flashAll(const std::string& path, const Options& options)
+{
+    auto serials = Flasher::serials();
+    if (serials.empty()) {
+        Logger::error("main") << "No devices found";
+        return -1;
+    }
+
+    Logger::info("main") << "Found" << serials.size() << "devices";
+
+    // The image is parsed once against the first device and shared by every worker
+    std::shared_ptr<DeviceInfo> deviceInfo;
+    {
+        Flasher flasher(serials.front());
+        if (flasher.switchMode(Flasher::MODE_BOOT)) {
+            deviceInfo = flasher.deviceInfo();
+        }
+    }
+
+    if (!deviceInfo) {
+        Logger::error("main") << "Failed retrieving device info from" << serials.front();
+        return -1;
+    }
+
+    auto flashFile = loadFlashFile(path, *deviceInfo, options);
+    if (!flashFile) {
+        return -1;
+    }
+
+    if (options.eventLoop) {
+        std::vector<std::thread> workers;
+        for (const auto& serial: serials) {
+            workers.emplace_back([&serial]() {
+                Flasher flasher(serial);
+                if (!flasher.switchMode(Flasher::MODE_BOOT)) {
+                    Logger::error("main") << serial << "could not switch to boot mode";
+                }
+            });
+        }
+
+        for (auto& w: workers) {
+            w.join();
+        }
+
+        return runEngine(*flashFile, *deviceInfo, options);
+    }
+
+    struct Result {
+        bool success = false;
+        uint64_t ms = 0;
+    };
+
+    ext::Timer timer;
+    std::vector<Result> results(serials.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < serials.size(); ++i) {
+        workers.emplace_back([&, i]() {
+            ext::Timer t;
+            Flasher flasher(serials[i]);
+            flasher.setWindow(options.window);
+
+            std::shared_ptr<DeviceInfo> info;
+            if (flasher.switchMode(Flasher::MODE_BOOT)) {
+                info = flasher.deviceInfo();
+            }
+
+            if (!info || info->memInfo() != deviceInfo->memInfo()) {
+                Logger::error("main") << serials[i] << "has a different memory layout, skipping";
+            } else {
+                results[i].success = flashDevice(flasher, *flashFile, *info, options);
+            }
+
+            results[i].ms = t.elapsedMs();
+        });
+    }
+
+    for (auto& w: workers) {
+        w.join();
+    }
+
+    uint32_t failed = 0;
+    for (size_t i = 0; i < serials.size(); ++i) {
+        Logger::info("main") ("%s: %s in %llu ms", serials[i].c_str(), results[i].success ? "done" : "FAILED", static_cast<unsigned long long>(results[i].ms));
+        failed += results[i].success ? 0 : 1;
+    }
+
+    Logger::info("main") << "Flashed" << serials.size() << "devices in" << timer.elapsedMs() << "ms," << failed << "failed";
+    return (failed == 0) ? 0 : -1;
+}
+
+bool decodeDevices(const std::vector<Flasher*>& devices, const std::string& path, const std::string& output, const DeviceInfo& deviceInfo,
+    const Options& options)
+{
+    auto flashFile = loadFlashFile(path, deviceInfo, options);
+    if (!flashFile) {
+        return false;
+    }
+
+    std::unique_ptr<FlashFile> reference;
+    if (!options.reference.empty()) {
+        reference = std::make_unique<FlashFile>(options.reference, deviceInfo);
+        if (!*reference) {
+            Logger::error("main") << "Failed parsing reference file";
+            return false;
+        }
+    }
+
+    ProbeModel model;
+    if (!options.model.empty() && !model.load(options.model)) {
+        return false;
+    }
+
+    // Shares the directory of parsed images, records are told apart by their ciphertext
+    std::unique_ptr<DecodeCache> cache;
+    if (!options.cacheDir.empty()) {
+        cache = std::make_unique<DecodeCache>(options.cacheDir + "/decode.gbdc");
+        if (!cache->open()) {
+            return false;
+        }
+    }
+
+    DumpWriter writer(output, DumpWriter::formatOf(output));
+    if (!writer) {
+        return false;
+    }
+
+    ext::Timer timer;
+    Decoder decoder(*flashFile, model, !!reference ? &reference->image() : nullptr, cache.get());
+    bool ok = decoder.run(devices, [&writer](uint32_t address, const uint8_t* data, size_t size) {
+        return writer.write(address, data, size);
+    });
+
+    ok = writer.close() && ok;
+    // Bytes recovered before a failure still help the next run
+    if (!options.model.empty()) {
+        model.save(options.model);
+    }
+
+    Flasher::Stats stats;
+    for (auto* f: devices) {
+        auto s = f->stats();
+        stats.probes += s.probes;
+        stats.probed += s.probed;
+        stats.predicted += s.predicted;
+    }
+
+    Logger::info("main") ("Recovered %u bytes on %u devices, %u from the reference, with %u probes, %.1f round trips per byte, in %u ms",
+        stats.probed, static_cast<uint32_t>(devices.size()), stats.predicted, stats.probes,
+        (stats.probed > 0) ? static_cast<double>(stats.probes) / stats.probed : 0.0, static_cast<uint32_t>(timer.elapsedMs()));
+    return ok;
+}
+
+int decodeAll(const std::string& path, const std::string& output, const Options& options)
+{
+    auto serials = Flasher::serials();
+    if (serials.empty()) {
+        Logger::error("main") << "No devices found";
+        return -1;
+    }
+
+    Logger::info("main") << "Found" << serials.size() << "devices";
+
+    std::vector<std::unique_ptr<Flasher>> flashers(serials.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < serials.size(); ++i) {
+        workers.emplace_back([&, i]() {
+            auto flasher = std::make_unique<Flasher>(serials[i]);
+            flasher->setProbeWindow(options.probeWindow);
+            if (!flasher->switchMode(Flasher::MODE_BOOT)) {
+                Logger::error("main") << serials[i] << "could not switch to boot mode, skipping";
+                return;
+            }
+
+            flashers[i] = std::move(flasher);
+        });
+    }
+
+    for (auto& w: workers) {
+        w.join();
+    }
+
+    // Every device must hold the same image, which is parsed against the first one
+    std::vector<Flasher*> devices;
+    std::shared_ptr<DeviceInfo> deviceInfo;
+    for (const auto& f: flashers) {
+        if (!f) {
+            continue;
+        }
+
+        auto info = f->deviceInfo();
+        if (!!info && !deviceInfo) {
+            deviceInfo = info;
+        }
+
+        if (!info || info->memInfo() != deviceInfo->memInfo()) {
+            Logger::error("main") << f->serial() << "has a different memory layout, skipping";
+            continue;
+        }
+
+        devices.push_back(f.get());
+    }
+
+    if (devices.empty()) {
+        Logger::error("main") << "No device to decode with";
+        return -1;
+    }
+
+    return decodeDevices(devices, path, output, *deviceInfo, options) ? 0 : -1;
+}
+
 int main(int argc, char** argv)
 {
     Logger::start();
@@ -29,7 +468,15 @@ int main(int argc, char** argv)
         Logger::stop();
     });
 
-    bool noReset = false;
+    Options options;
+    bool emulate = false;
+    uint32_t latency = 0;
+    uint32_t units = 1;
+    std::string capture;
+    std::string replay;
+    double replaySpeed = 1.0;
+    bool all = false;
+    std::string serial;
     std::string cmd;
     std::vector<std::string> args;
 
@@ -43,7 +490,52 @@ int main(int argc, char** argv)
             if (a == "-v" || a == "--verbose") {
                 Logger::setVerbose(true);
             } else if (a == "-n" || a == "--no-reset") {
-                noReset = true;
+                options.noReset = true;
+            } else if ((a == "-w" || a == "--window") && i + 1 < argc) {
+                options.window = std::strtoul(argv[++i], nullptr, 10);
+            } else if (a == "--probe-window" && i + 1 < argc) {
+                options.probeWindow = std::strtoul(argv[++i], nullptr, 10);
+            } else if (a == "-e" || a == "--emulate") {
+                emulate = true;
+            } else if (a == "--latency" && i + 1 < argc) {
+                latency = std::strtoul(argv[++i], nullptr, 10);
+            } else if (a == "--units" && i + 1 < argc) {
+                units = std::strtoul(argv[++i], nullptr, 10);
+            } else if (a == "--if-changed") {
+                options.ifChanged = true;
+            } else if (a == "--stream") {
+                options.stream = true;
+            } else if (a == "--queue" && i + 1 < argc) {
+                options.queueDepth = std::max<uint32_t>(1, std::strtoul(argv[++i], nullptr, 10));
+            } else if (a == "--cache" && i + 1 < argc) {
+                options.cacheDir = argv[++i];
+            } else if (a == "--model" && i + 1 < argc) {
+                options.model = argv[++i];
+            } else if (a == "--reference" && i + 1 < argc) {
+                options.reference = argv[++i];
+            } else if (a == "--capture" && i + 1 < argc) {
+                capture = argv[++i];
+            } else if (a == "--replay" && i + 1 < argc) {
+                replay = argv[++i];
+            } else if (a == "--replay-speed" && i + 1 < argc) {
+                replaySpeed = std::strtod(argv[++i], nullptr);
+            } else if (a == "-E" || a == "--event-loop") {
+                options.eventLoop = true;
+            } else if (a == "-a" || a == "--all") {
+                all = true;
+            } else if ((a == "-s" || a == "--serial") && i + 1 < argc) {
+                serial = argv[++i];
+            } else if (a == "--backend" && i + 1 < argc) {
+                std::string backend = argv[++i];
+                if (backend == "hidapi") {
+                    HID::setBackend(HID::BACKEND_HIDAPI);
+#ifdef __linux__
+                } else if (backend == "hidraw") {
+                    HID::setBackend(HID::BACKEND_HIDRAW);
+#endif
+                } else {
+                    return showUsage();
+                }
             } else {
                 return showUsage();
             }
@@ -60,7 +552,57 @@ int main(int argc, char** argv)
         return showUsage();
     }
 
-    Flasher flasher;
+    if (options.ifChanged && (options.eventLoop || options.stream)) {
+        Logger::warning("main") << "--if-changed only applies to the regular flashing path, ignoring it";
+    }
+
+    if (emulate) {
+        auto emulator = std::make_shared<Emulator>(units);
+        emulator->setLatency(std::chrono::microseconds(latency));
+        HID::setBus(emulator);
+    }
+
+    std::shared_ptr<Replay> replayBus;
+    if (!replay.empty()) {
+        auto entries = Trace::load(replay);
+        if (entries.empty()) {
+            return -1;
+        }
+
+        Logger::info("main") << "Replaying" << entries.size() << "reports from" << replay;
+        replayBus = std::make_shared<Replay>(std::move(entries));
+        replayBus->setSpeed(replaySpeed);
+        HID::setBus(replayBus);
+    }
+
+    if (!capture.empty()) {
+        auto trace = std::make_shared<Trace>();
+        if (!trace->open(capture)) {
+            return -1;
+        }
+
+        HID::setTrace(trace);
+    }
+
+    if (all) {
+        if (args.empty()) {
+            return showUsage();
+        }
+
+        if (cmd == "decode") {
+            return decodeAll(args.at(0), (args.size() > 1) ? args.at(1) : "-", options);
+        }
+
+        if (cmd != "flash") {
+            return showUsage();
+        }
+
+        return flashAll(args.at(0), options);
+    }
+
+    Flasher flasher(serial);
+    flasher.setWindow(options.window);
+    flasher.setProbeWindow(options.probeWindow);
     if (!flasher.switchMode(Flasher::MODE_BOOT)) {
         Logger::error("main") << "Could not switch to boot mode";
         return -1;
@@ -84,62 +626,59 @@ int main(int argc, char** argv)
         if (!!appInfo) {
             Logger::info("main") << "Device app info:" << "App version" << appInfo->appVersion() << ", Bootloader version" << appInfo->bootloaderVersion();
         }
-    } else if (cmd == "flash") {
+    } else if (cmd == "flash" && options.stream && !options.eventLoop) {
         if (args.empty()) {
             return showUsage();
         }
 
-        FlashFile flashFile(args.at(0), *deviceInfo);
-        if (!flashFile) {
-            Logger::error("main") << "Failed parsing firmware file";
+        if (!streamDevice(flasher, args.at(0), *deviceInfo, options)) {
             return -1;
         }
+    } else if (cmd == "flash") {
+        if (args.empty()) {
+            return showUsage();
+        }
 
-        auto flashAppInfo = flashFile.appInfo();
-        if (!flashAppInfo) {
-            Logger::error("main") << "Missing app info in flash file";
+        auto flashFile = loadFlashFile(args.at(0), *deviceInfo, options);
+        if (!flashFile) {
             return -1;
         }
 
-        auto appInfo = flasher.appInfo();
-        if (!!appInfo) {
-            Logger::info("main") << "Device app info:" << "App version" << appInfo->appVersion() << ", Bootloader version" << appInfo->bootloaderVersion();
+        if (options.eventLoop) {
+            flasher.close();
+            return runEngine(*flashFile, *deviceInfo, options, flasher.serial());
         }
 
-        Logger::info("main") << "Firmware app info:" << "App version" << flashAppInfo->appVersion() << ", Bootloader version" << flashAppInfo->bootloaderVersion();
-
-        flasher.erase();
-
-        if (!flasher.flash(flashFile, *deviceInfo)) {
-            Logger::error("main") << "Failed flashing";
+        if (!flashDevice(flasher, *flashFile, *deviceInfo, options)) {
             return -1;
         }
-
-        if (!flasher.verify(flashFile, *deviceInfo)) {
-            Logger::error("main") << "Failed verifying";
-            return -1;
+    } else if (cmd == "reset") {
+        flasher.switchMode(Flasher::MODE_REGULAR);
+    } else if (cmd == "erase") {
+        flasher.erase();
+    } else if (cmd == "decode") {
+        if (args.empty()) {
+            return showUsage();
         }
 
-        if (!flasher.setAppInfo(flashFile, *deviceInfo, *flashAppInfo)) {
-            Logger::error("main") << "Failed flashing app info";
+        if (!decodeDevices({&flasher}, args.at(0), (args.size() > 1) ? args.at(1) : "-", *deviceInfo, options)) {
             return -1;
         }
-
-        auto newAppInfo = flasher.appInfo();
-        if (!!newAppInfo) {
-            Logger::info("main") << "Flashed app info:" << "App version" << newAppInfo->appVersion() << ", Bootloader version" << newAppInfo->bootloaderVersion();
+    } else if (cmd == "dump") {
+        if (args.size() < 3) {
+            return showUsage();
         }
 
-        if (!noReset) {
-            flasher.switchMode(Flasher::MODE_REGULAR);
+        if (!dumpDevice(flasher, strtoul(args.at(0).c_str(), nullptr, 0), strtoul(args.at(1).c_str(), nullptr, 0), args.at(2))) {
+            return -1;
         }
-    } else if (cmd == "reset") {
-        flasher.switchMode(Flasher::MODE_REGULAR);
-    } else if (cmd == "erase") {
-        flasher.erase();
     } else {
         return showUsage();
     }
 
+    if (!!replayBus) {
+        Logger::info("main") << "Replay:" << replayBus->mismatches() << "reports differed from the recording," << replayBus->remaining() << "left unsent";
+    }
+
     return 0;
 }
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cstring>
+
+#include "memoryimage.h"
+
+MemoryImage::MemoryImage()
+    : mDirectory(DIRECTORY_SIZE)
+{}
+
+void MemoryImage::write(uint32_t address, const uint8_t* data, size_t size)
+{
+    own();
+    while (size > 0) {
+        auto& p = page(address);
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        uint32_t n = static_cast<uint32_t>(std::min<size_t>(size, PAGE_SIZE - offset));
+        memcpy(&mArena[p.offset + offset], data, n);
+        setRange(p.valid, offset, n);
+
+        address += n;
+        data += n;
+        size -= n;
+    }
+}
+
+void MemoryImage::write(uint32_t address, const uint8_t* data, const Bitmap& valid)
+{
+    own();
+    auto& p = page(address);
+    for (uint32_t i = 0; i < PAGE_SIZE; ++i) {
+        if ((valid[i >> 6U] >> (i & 63U)) & 1U) {
+            mArena[p.offset + i] = data[i];
+        }
+    }
+
+    for (size_t i = 0; i < valid.size(); ++i) {
+        p.valid[i] |= valid[i];
+    }
+}
+
+bool MemoryImage::read(uint32_t address, uint8_t* dst, size_t size) const
+{
+    while (size > 0) {
+        const auto* p = find(address);
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        uint32_t n = static_cast<uint32_t>(std::min<size_t>(size, PAGE_SIZE - offset));
+        if (p == nullptr || !testRange(p->valid, offset, n)) {
+            return false;
+        }
+
+        memcpy(dst, bytes() + p->offset + offset, n);
+        address += n;
+        dst += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+bool MemoryImage::valid(uint32_t address, size_t size) const
+{
+    while (size > 0) {
+        const auto* p = find(address);
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        uint32_t n = static_cast<uint32_t>(std::min<size_t>(size, PAGE_SIZE - offset));
+        if (p == nullptr || !testRange(p->valid, offset, n)) {
+            return false;
+        }
+
+        address += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+const uint8_t* MemoryImage::at(uint32_t address, size_t size) const
+{
+    const uint8_t* ret = nullptr;
+    const Page* prev = nullptr;
+    while (size > 0) {
+        const auto* p = find(address);
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        uint32_t n = static_cast<uint32_t>(std::min<size_t>(size, PAGE_SIZE - offset));
+        if (p == nullptr || !testRange(p->valid, offset, n)) {
+            return nullptr;
+        }
+
+        if (prev == nullptr) {
+            ret = bytes() + p->offset + offset;
+        } else if (p->offset != prev->offset + PAGE_SIZE) {
+            return nullptr;
+        }
+
+        prev = p;
+        address += n;
+        size -= n;
+    }
+
+    return ret;
+}
+
+void MemoryImage::compact()
+{
+    std::vector<uint8_t> arena(mPages.size() * PAGE_SIZE);
+    for (size_t i = 0; i < mPages.size(); ++i) {
+        auto& p = mPages[i];
+        memcpy(&arena[i * PAGE_SIZE], bytes() + p.offset, PAGE_SIZE);
+        p.offset = static_cast<uint32_t>(i * PAGE_SIZE);
+    }
+
+    mArena.swap(arena);
+    mMapped = nullptr;
+    mMappedSize = 0;
+    mPages.shrink_to_fit();
+}
+
+void MemoryImage::map(const uint8_t* arena, size_t size, std::vector<Page> pages)
+{
+    for (auto& leaf: mDirectory) {
+        leaf.reset();
+    }
+
+    mArena.clear();
+    mArena.shrink_to_fit();
+    mMapped = arena;
+    mMappedSize = size;
+    mPages = std::move(pages);
+    for (size_t i = 0; i < mPages.size(); ++i) {
+        index(mPages[i].address >> PAGE_SHIFT, static_cast<uint32_t>(i));
+    }
+}
+
+void MemoryImage::own()
+{
+    if (mMapped == nullptr) {
+        return;
+    }
+
+    mArena.assign(mMapped, mMapped + mMappedSize);
+    mMapped = nullptr;
+    mMappedSize = 0;
+}
+
+size_t MemoryImage::footprint() const
+{
+    size_t leaves = std::count_if(mDirectory.begin(), mDirectory.end(), [](const std::unique_ptr<Leaf>& l) { return !!l; });
+    return mArena.capacity() + mPages.capacity() * sizeof(Page) + mDirectory.size() * sizeof(mDirectory[0]) + leaves * sizeof(Leaf);
+}
+
+const MemoryImage::Page* MemoryImage::find(uint32_t address) const
+{
+    uint32_t number = address >> PAGE_SHIFT;
+    const auto& leaf = mDirectory[number >> LEAF_SHIFT];
+    if (!leaf) {
+        return nullptr;
+    }
+
+    uint32_t slot = (*leaf)[number & (LEAF_SIZE - 1)];
+    return (slot == 0) ? nullptr : &mPages[slot - 1];
+}
+
+MemoryImage::Page& MemoryImage::page(uint32_t address)
+{
+    const auto* p = find(address);
+    if (p != nullptr) {
+        return const_cast<Page&>(*p);
+    }
+
+    // Records mostly arrive in address order, so new pages are nearly always appended to the index
+    Page n{address & ~(PAGE_SIZE - 1), static_cast<uint32_t>(mArena.size()), {}};
+    mArena.resize(mArena.size() + PAGE_SIZE, 0xFFU);
+    auto it = mPages.end();
+    if (!mPages.empty() && mPages.back().address > n.address) {
+        it = std::lower_bound(mPages.begin(), mPages.end(), n.address, [](const Page& a, uint32_t b) { return a.address < b; });
+    }
+
+    size_t slot = it - mPages.begin();
+    mPages.insert(it, n);
+    for (size_t i = slot; i < mPages.size(); ++i) {
+        index(mPages[i].address >> PAGE_SHIFT, static_cast<uint32_t>(i));
+    }
+
+    return mPages[slot];
+}
+
+void MemoryImage::index(uint32_t number, uint32_t slot)
+{
+    auto& leaf = mDirectory[number >> LEAF_SHIFT];
+    if (!leaf) {
+        leaf.reset(new Leaf());
+        leaf->fill(0);
+    }
+
+    (*leaf)[number & (LEAF_SIZE - 1)] = slot + 1;
+}
+
+void MemoryImage::setRange(Bitmap& bits, uint32_t offset, uint32_t count)
+{
+    while (count > 0) {
+        uint32_t bit = offset & 63U;
+        uint32_t n = std::min(count, 64U - bit);
+        bits[offset >> 6U] |= (n == 64U) ? ~0ULL : (((1ULL << n) - 1U) << bit);
+        offset += n;
+        count -= n;
+    }
+}
+
+bool MemoryImage::testRange(const Bitmap& bits, uint32_t offset, uint32_t count)
+{
+    while (count > 0) {
+        uint32_t bit = offset & 63U;
+        uint32_t n = std::min(count, 64U - bit);
+        uint64_t mask = (n == 64U) ? ~0ULL : (((1ULL << n) - 1U) << bit);
+        if ((bits[offset >> 6U] & mask) != mask) {
+            return false;
+        }
+
+        offset += n;
+        count -= n;
+    }
+
+    return true;
+}
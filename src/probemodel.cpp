@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+
+#include "ext/bufferstream.h"
+#include "ext/bufferview.h"
+#include "ext/mappedfile.h"
+#include "logger.h"
+#include "probemodel.h"
+
+namespace {
+const uint8_t MAGIC[4] = {'G', 'B', 'P', 'M'};
+}
+
+ProbeModel::ProbeModel()
+    : mFollow(256)
+    , mFollowTotal(256)
+{
+    for (auto& c: mFollow) {
+        c.fill(0);
+    }
+}
+
+void ProbeModel::learn(uint32_t address, const uint8_t* data, size_t size, const uint8_t* previous)
+{
+    for (size_t i = 0; i < size; ++i, ++address) {
+        add(mGlobal, mTotal, data[i]);
+        add(mPosition[address % POSITIONS], mPositionTotal[address % POSITIONS], data[i]);
+        if (previous != nullptr) {
+            add(mFollow[*previous], mFollowTotal[*previous], data[i]);
+        }
+
+        previous = &data[i];
+    }
+}
+
+void ProbeModel::order(uint32_t address, const uint8_t* previous, Order& order) const
+{
+    // Each context backs off to the broader one below it in proportion to how rarely it was seen
+    const auto& position = mPosition[address % POSITIONS];
+    const double positionTotal = mPositionTotal[address % POSITIONS];
+    const double positionWeight = positionTotal / (positionTotal + CONFIDENCE);
+    const double followTotal = (previous != nullptr) ? mFollowTotal[*previous] : 0.0;
+    const double followWeight = followTotal / (followTotal + CONFIDENCE);
+
+    std::array<double, 256> score;
+    for (uint32_t v = 0; v < 256; ++v) {
+        double p = (mGlobal[v] + 1.0) / (mTotal + 256.0);
+        if (positionTotal > 0) {
+            p = positionWeight * position[v] / positionTotal + (1.0 - positionWeight) * p;
+        }
+
+        if (followTotal > 0) {
+            p = followWeight * mFollow[*previous][v] / followTotal + (1.0 - followWeight) * p;
+        }
+
+        score[v] = p;
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        order[i] = static_cast<uint8_t>(0xFFU - i);
+    }
+
+    // Ties go to the higher value, as erased flash is the likelier guess. std::sort keeps this off the heap,
+    // unlike std::stable_sort
+    std::sort(order.begin(), order.end(), [&score](uint8_t a, uint8_t b) {
+        return score[a] > score[b] || (score[a] == score[b] && a > b);
+    });
+}
+
+bool ProbeModel::load(const std::string& path)
+{
+    ext::MappedFile file(path);
+    if (file.missing()) {
+        return true;
+    }
+
+    if (!file) {
+        return false;
+    }
+
+    const size_t counts = 256 * (1 + POSITIONS + 256);
+    ext::BufferView view(reinterpret_cast<const uint8_t*>(file.data()), file.size());
+    auto magic = view.readView(sizeof(MAGIC));
+    auto version = view.readUInt32();
+    if (magic.size() != sizeof(MAGIC) || memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0 || version != VERSION
+        || view.remain() != counts * 4) {
+        Logger::error<ProbeModel>("load") << path << "is not a probe model";
+        return false;
+    }
+
+    auto read = [&view](Counts& c, uint64_t& total) {
+        for (auto& v: c) {
+            v = view.readUInt32();
+        }
+
+        total = std::accumulate(c.begin(), c.end(), uint64_t(0));
+    };
+
+    read(mGlobal, mTotal);
+    for (uint32_t i = 0; i < POSITIONS; ++i) {
+        read(mPosition[i], mPositionTotal[i]);
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        read(mFollow[i], mFollowTotal[i]);
+    }
+
+    Logger::verbose<ProbeModel>("load") << "Loaded" << mTotal << "samples from" << path;
+    return true;
+}
+
+bool ProbeModel::save(const std::string& path) const
+{
+    ext::BufferStream stream;
+    stream.append(std::vector<uint8_t>(MAGIC, MAGIC + sizeof(MAGIC)));
+    stream.appendDword(VERSION);
+    auto write = [&stream](const Counts& c) {
+        for (auto v: c) {
+            stream.appendDword(v);
+        }
+    };
+
+    write(mGlobal);
+    for (const auto& c: mPosition) {
+        write(c);
+    }
+
+    for (const auto& c: mFollow) {
+        write(c);
+    }
+
+    // Written aside and renamed into place so an interrupted save keeps the previous model
+    auto tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        Logger::error<ProbeModel>("save") << "Could not create" << tmp << ":" << strerror(errno);
+        return false;
+    }
+
+    const auto data = stream.data();
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        Logger::error<ProbeModel>("save") << "Could not write" << path;
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void ProbeModel::add(Counts& counts, uint64_t& total, uint8_t value)
+{
+    // Halving keeps the counts in range and lets the model follow a firmware that differs from the ones
+    // it was trained on
+    if (counts[value] == UINT32_MAX) {
+        total = 0;
+        for (auto& c: counts) {
+            c >>= 1U;
+            total += c;
+        }
+    }
+
+    ++counts[value];
+    ++total;
+}
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#include "ext/allocations.h"
+#include "flasher.h"
+#include "logger.h"
+#include "replay.h"
+#include "replies.h"
+
+class Replay::Cursor {
+public:
+    static constexpr auto Tag = "Replay::Cursor";
+
+    using Clock = Replies::Clock;
+
+    // A recorded request and the reply it got, if any
+    struct Exchange {
+        const Trace::Entry* request;
+        const Trace::Entry* reply;
+        // Time the device spent on the request once it got to it, queueing behind earlier requests excluded
+        std::chrono::nanoseconds service;
+        bool used;
+    };
+
+public:
+    Cursor(std::vector<Trace::Entry> entries);
+
+    void handle(const uint8_t* data, size_t size);
+    int read(uint8_t* data, size_t size, int timeout);
+
+private:
+    Exchange* match(const uint8_t* data, size_t size);
+
+    static bool switches(const Trace::Entry& e);
+
+public:
+    std::vector<Trace::Entry> entries;
+    std::vector<Exchange> exchanges;
+    double speed = 1.0;
+
+    mutable std::mutex mutex;
+    uint8_t mode = Flasher::MODE_BOOT;
+    uint32_t mismatches = 0;
+    Replies replies;
+
+private:
+    // Exchanges before this one are all used
+    size_t first = 0;
+};
+
+Replay::Cursor::Cursor(std::vector<Trace::Entry> entries)
+    : entries(std::move(entries))
+{
+    // The device answers in order, so the n-th reply belongs to the n-th request still waiting for one
+    std::deque<size_t> waiting;
+    uint64_t idle = 0;
+    for (const auto& e: this->entries) {
+        if (e.direction == Trace::DIR_OUT) {
+            exchanges.push_back({&e, nullptr, {}, false});
+            if (switches(e)) {
+                // Mode switches get no reply and drop whatever was still queued
+                waiting.clear();
+                idle = e.ns;
+            } else {
+                waiting.push_back(exchanges.size() - 1);
+            }
+        } else if (!waiting.empty()) {
+            auto& x = exchanges[waiting.front()];
+            waiting.pop_front();
+            x.reply = &e;
+            x.service = std::chrono::nanoseconds(e.ns - std::max(x.request->ns, idle));
+            idle = e.ns;
+        }
+    }
+
+    // A session recorded from regular mode starts by asking for the bootloader
+    if (!exchanges.empty() && exchanges.front().request->report == Flasher::REPORT_BOOT) {
+        mode = Flasher::MODE_REGULAR;
+    }
+}
+
+bool Replay::Cursor::switches(const Trace::Entry& e)
+{
+    return (e.report == Flasher::REPORT_BOOT && e.data[0] == Flasher::CMD_BOOTLOADER)
+        || (e.report == Flasher::REPORT_NORMAL && e.data[0] == Flasher::CMD_RESET);
+}
+
+Replay::Cursor::Exchange* Replay::Cursor::match(const uint8_t* data, size_t size)
+{
+    while (first < exchanges.size() && exchanges[first].used) {
+        ++first;
+    }
+
+    // Hosts may order requests differently than the recorded one did, so look for the same report
+    // anywhere ahead before settling for the next one in line
+    auto len = std::min<size_t>(size - 1, 64);
+    for (size_t i = first; i < exchanges.size(); ++i) {
+        auto& x = exchanges[i];
+        if (!x.used && x.request->report == data[0] && memcmp(x.request->data.data(), data + 1, len) == 0) {
+            return &x;
+        }
+    }
+
+    ++mismatches;
+    Logger::verbose<Cursor>("match") << "Report" << first << "differs from the recording";
+    return (first < exchanges.size()) ? &exchanges[first] : nullptr;
+}
+
+void Replay::Cursor::handle(const uint8_t* data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (size < 2) {
+        return;
+    }
+
+    if (data[0] == Flasher::REPORT_BOOT && data[1] == Flasher::CMD_BOOTLOADER) {
+        mode = Flasher::MODE_BOOT;
+    } else if (data[0] == Flasher::REPORT_NORMAL && data[1] == Flasher::CMD_RESET) {
+        mode = Flasher::MODE_REGULAR;
+    }
+
+    auto* x = match(data, size);
+    if (x == nullptr) {
+        Logger::warning<Cursor>("handle") << "Report written past the end of the recording";
+        return;
+    }
+
+    x->used = true;
+    if (switches(*x->request)) {
+        replies.reset();
+        return;
+    }
+
+    if (x->reply == nullptr) {
+        return;
+    }
+
+    // The device works through requests one at a time, a request starts once the previous reply is out
+    auto service = std::chrono::nanoseconds((speed > 0) ? static_cast<int64_t>(x->service.count() / speed) : 0);
+    auto start = std::max(Clock::now(), replies.idle());
+    replies.push(start + std::chrono::duration_cast<Clock::duration>(service), {x->reply->data.begin(), x->reply->data.end()});
+}
+
+int Replay::Cursor::read(uint8_t* data, size_t size, int timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return replies.read(lock, data, size, timeout);
+}
+
+Replay::Device::Device(std::string path, std::shared_ptr<Cursor> cursor, uint16_t pid)
+    : HID::Device(std::move(path))
+    , mCursor(std::move(cursor))
+    , mPid(pid)
+{}
+
+Replay::Device::~Device()
+{
+    close();
+}
+
+bool Replay::Device::open()
+{
+    std::unique_lock<std::mutex> lock(mCursor->mutex);
+    if (mOpen) {
+        Logger::warning<Replay::Device>("open") << "Already opened";
+        return false;
+    }
+
+    bool boot = (mCursor->mode == Flasher::MODE_BOOT);
+    if (boot != (mPid == Flasher::GB_BOOT_PID)) {
+        return false;
+    }
+
+    mGeneration = mCursor->replies.generation();
+    mOpen = true;
+    return true;
+}
+
+void Replay::Device::close()
+{
+    mOpen = false;
+}
+
+bool Replay::Device::isOpen() const
+{
+    std::unique_lock<std::mutex> lock(mCursor->mutex);
+    return mOpen && mGeneration == mCursor->replies.generation();
+}
+
+int Replay::Device::fd() const
+{
+    return mCursor->replies.fd();
+}
+
+int Replay::Device::readReport(uint8_t* data, size_t size, int timeout)
+{
+    ext::Allocations::Pause pause;
+    return mCursor->read(data, size, timeout);
+}
+
+int Replay::Device::writeReport(const uint8_t* data, size_t size)
+{
+    ext::Allocations::Pause pause;
+    mCursor->handle(data, size);
+    return size;
+}
+
+Replay::Replay(std::vector<Trace::Entry> entries)
+    : mCursor(std::make_shared<Cursor>(std::move(entries)))
+{}
+
+void Replay::setSpeed(double speed)
+{
+    std::unique_lock<std::mutex> lock(mCursor->mutex);
+    mCursor->speed = speed;
+}
+
+uint32_t Replay::mismatches() const
+{
+    std::unique_lock<std::mutex> lock(mCursor->mutex);
+    return mCursor->mismatches;
+}
+
+uint32_t Replay::remaining() const
+{
+    std::unique_lock<std::mutex> lock(mCursor->mutex);
+    return std::count_if(mCursor->exchanges.begin(), mCursor->exchanges.end(), [](const Cursor::Exchange& x) {
+        return !x.used;
+    });
+}
+
+std::vector<HID::Entry> Replay::enumerate(uint16_t vid, uint16_t pid, int interfaceNum)
+{
+    std::vector<HID::Entry> ret;
+    std::unique_lock<std::mutex> lock(mCursor->mutex);
+    if (vid != Flasher::GB_VID) {
+        return ret;
+    }
+
+    if (mCursor->mode == Flasher::MODE_BOOT && pid == Flasher::GB_BOOT_PID && interfaceNum <= 0) {
+        ret.push_back({"replay:FFE3:0", "REPLAY"});
+    } else if (mCursor->mode == Flasher::MODE_REGULAR && pid == Flasher::GB_PID && (interfaceNum == -1 || interfaceNum == 1)) {
+        ret.push_back({"replay:001B:1", "REPLAY"});
+    }
+
+    return ret;
+}
+
+std::shared_ptr<HID::Device> Replay::device(const std::string& path)
+{
+    auto pid = (path == "replay:FFE3:0") ? Flasher::GB_BOOT_PID : Flasher::GB_PID;
+    return std::make_shared<Device>(path, mCursor, pid);
+}
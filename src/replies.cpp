@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#include "replies.h"
+
+Replies::Replies()
+{
+#ifdef __linux__
+    mTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+}
+
+Replies::~Replies()
+{
+#ifdef __linux__
+    if (mTimer >= 0) {
+        ::close(mTimer);
+    }
+#endif
+}
+
+void Replies::push(Clock::time_point ready, std::vector<uint8_t> data)
+{
+    mQueue.emplace_back(std::max(ready, idle()), std::move(data));
+    if (mQueue.size() == 1) {
+        arm();
+    }
+
+    mCond.notify_all();
+}
+
+void Replies::reset()
+{
+    ++mGeneration;
+    mQueue.clear();
+    arm();
+    mCond.notify_all();
+}
+
+int Replies::read(std::unique_lock<std::mutex>& lock, uint8_t* data, size_t size, int timeout)
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+    auto gen = mGeneration;
+    while (mQueue.empty() || mQueue.front().first > Clock::now()) {
+        auto until = mQueue.empty() ? deadline : std::min(deadline, mQueue.front().first);
+        if (mCond.wait_until(lock, until) == std::cv_status::timeout && Clock::now() >= deadline) {
+            return 0;
+        }
+
+        if (gen != mGeneration) {
+            return -1;
+        }
+    }
+
+    auto r = std::move(mQueue.front().second);
+    mQueue.pop_front();
+    arm();
+
+    auto len = std::min(size, r.size());
+    std::copy(r.begin(), r.begin() + len, data);
+    return len;
+}
+
+void Replies::arm()
+{
+#ifdef __linux__
+    if (mTimer < 0) {
+        return;
+    }
+
+    // Re-arming also resets the expiration count, an empty queue disarms the timer
+    struct itimerspec spec = {};
+    if (!mQueue.empty()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mQueue.front().first.time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000LL;
+        spec.it_value.tv_nsec = ns % 1000000000LL;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(mTimer, TFD_TIMER_ABSTIME, &spec, nullptr);
+#endif
+}
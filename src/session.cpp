@@ -0,0 +1,38 @@
+#include "logger.h"
+#include "session.h"
+
+Session::Session(uint16_t vid, uint16_t pid, int interfaceNum, std::string serial)
+    : mVid(vid)
+    , mPid(pid)
+    , mInterface(interfaceNum)
+    , mSerial(std::move(serial))
+{}
+
+std::shared_ptr<HID::Device> Session::device()
+{
+    if (!!mDevice) {
+        return mDevice;
+    }
+
+    auto dev = HID::find(mVid, mPid, mInterface, mSerial);
+    if (!dev || !dev->open()) {
+        return nullptr;
+    }
+
+    Logger::verbose<Session>("device") ("Opened %04X:%04X", mVid, mPid);
+    mDevice = dev;
+    return mDevice;
+}
+
+bool Session::present() const
+{
+    return !!mDevice || !!HID::find(mVid, mPid, mInterface, mSerial);
+}
+
+void Session::invalidate()
+{
+    if (!!mDevice) {
+        Logger::verbose<Session>("invalidate") ("Closing %04X:%04X", mVid, mPid);
+        mDevice.reset();
+    }
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "logger.h"
+#include "trace.h"
+
+namespace {
+constexpr char MAGIC[8] = {'G', 'B', 'T', 'R', 'A', 'C', 'E', 0x01};
+}
+
+Trace::~Trace()
+{
+    close();
+}
+
+bool Trace::open(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFile = fopen(path.c_str(), "wb");
+    if (mFile == nullptr) {
+        Logger::error<Trace>("open") << "Could not create" << path << ":" << strerror(errno);
+        return false;
+    }
+
+    fwrite(MAGIC, 1, sizeof(MAGIC), mFile);
+    return true;
+}
+
+void Trace::close()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mFile != nullptr) {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+void Trace::append(Direction direction, const uint8_t* data, size_t size)
+{
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    uint8_t entry[ENTRY_SIZE] = {};
+    for (size_t i = 0; i < 8; ++i) {
+        entry[i] = static_cast<uint8_t>(ns >> (i * 8));
+    }
+
+    entry[8] = direction;
+    if (direction == DIR_OUT && size > 0) {
+        entry[9] = data[0];
+        ++data;
+        --size;
+    }
+
+    std::copy(data, data + std::min<size_t>(size, 64), entry + 10);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mFile != nullptr) {
+        fwrite(entry, 1, sizeof(entry), mFile);
+    }
+}
+
+std::vector<Trace::Entry> Trace::load(const std::string& path)
+{
+    std::vector<Entry> ret;
+    auto* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        Logger::error<Trace>("load") << "Could not open" << path << ":" << strerror(errno);
+        return ret;
+    }
+
+    char magic[sizeof(MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MAGIC, sizeof(magic)) != 0) {
+        Logger::error<Trace>("load") << path << "is not a report trace";
+        fclose(file);
+        return ret;
+    }
+
+    uint8_t entry[ENTRY_SIZE];
+    while (fread(entry, 1, sizeof(entry), file) == sizeof(entry)) {
+        Entry e;
+        e.ns = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            e.ns |= static_cast<uint64_t>(entry[i]) << (i * 8);
+        }
+
+        e.direction = static_cast<Direction>(entry[8]);
+        e.report = entry[9];
+        std::copy(entry + 10, entry + ENTRY_SIZE, e.data.begin());
+        ret.push_back(e);
+    }
+
+    fclose(file);
+    return ret;
+}
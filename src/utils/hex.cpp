@@ -1,10 +1,238 @@
+#include <array>
 #include <iostream>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEX_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define HEX_NEON
+#include <arm_neon.h>
+#endif
+
 #include "utils/hex.h"
 
+namespace {
+const char sDigits[] = "0123456789ABCDEF";
+
+// Nibble value of every character, 0xFF for non hex digits
+const std::array<uint8_t, 256> sNibbles = []() {
+    std::array<uint8_t, 256> ret;
+    for (size_t i = 0; i < ret.size(); ++i) {
+        bool error;
+        auto r = utils::Hex::toNibble(static_cast<char>(i), error);
+        ret[i] = error ? 0xFFU : r;
+    }
+
+    return ret;
+}();
+
+bool decodeScalar(const char* src, size_t count, uint8_t* dst, uint8_t& sum)
+{
+    const auto* s = reinterpret_cast<const uint8_t*>(src);
+    uint8_t invalid = 0;
+    uint8_t acc = 0;
+    for (size_t i = 0; i < count; ++i) {
+        auto hi = sNibbles[s[i * 2]];
+        auto lo = sNibbles[s[i * 2 + 1]];
+        invalid |= (hi | lo);
+        dst[i] = static_cast<uint8_t>(hi << 4U) | lo;
+        acc += dst[i];
+    }
+
+    sum += acc;
+
+    // Only invalid characters have the high bits set
+    return (invalid & 0xF0U) == 0;
+}
+
+void encodeScalar(const uint8_t* src, size_t count, char* dst)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i * 2] = sDigits[src[i] >> 4U];
+        dst[i * 2 + 1] = sDigits[src[i] & 0x0FU];
+    }
+}
+
+#ifdef HEX_X86
+// Nibble values of 16 characters and a mask of the ones that are hex digits
+__attribute__((target("ssse3")))
+inline __m128i nibbles(__m128i v, __m128i& valid)
+{
+    auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    auto digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+    auto alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+    valid = _mm_and_si128(valid, _mm_or_si128(digit, alpha));
+    return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+        _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+__attribute__((target("ssse3")))
+bool decodeSSSE3(const char* src, size_t count, uint8_t* dst, uint8_t& sum)
+{
+    auto valid = _mm_set1_epi8(-1);
+    auto acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto n = nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)), valid);
+        // hi * 16 + lo for each pair of characters, then narrowed back to bytes
+        auto bytes = _mm_packus_epi16(_mm_maddubs_epi16(n, _mm_set1_epi16(0x0110)), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), bytes);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    }
+
+    sum += static_cast<uint8_t>(_mm_cvtsi128_si32(acc));
+    bool ok = _mm_movemask_epi8(valid) == 0xFFFF;
+    return decodeScalar(src + i * 2, count - i, dst + i, sum) && ok;
+}
+
+__attribute__((target("avx2")))
+bool decodeAVX2(const char* src, size_t count, uint8_t* dst, uint8_t& sum)
+{
+    auto valid = _mm256_set1_epi8(-1);
+    auto acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+        auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        auto digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        auto alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+        valid = _mm256_and_si256(valid, _mm256_or_si256(digit, alpha));
+        auto n = _mm256_or_si256(_mm256_and_si256(digit, _mm256_sub_epi8(v, _mm256_set1_epi8('0'))),
+            _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+
+        // Packing works per 128 bit lane, the two 8 byte halves are gathered afterwards
+        auto packed = _mm256_packus_epi16(_mm256_maddubs_epi16(n, _mm256_set1_epi16(0x0110)), _mm256_setzero_si256());
+        auto bytes = _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    }
+
+    sum += static_cast<uint8_t>(_mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4));
+    bool ok = static_cast<uint32_t>(_mm256_movemask_epi8(valid)) == 0xFFFFFFFFU;
+    return decodeSSSE3(src + i * 2, count - i, dst + i, sum) && ok;
+}
+
+__attribute__((target("ssse3")))
+void encodeSSSE3(const uint8_t* src, size_t count, char* dst)
+{
+    const auto digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sDigits));
+    const auto mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        auto hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        auto lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+
+    encodeScalar(src + i, count - i, dst + i * 2);
+}
+
+__attribute__((target("avx2")))
+void encodeAVX2(const uint8_t* src, size_t count, char* dst)
+{
+    const auto digits = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sDigits)));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // Each byte widened to 16 bits, high nibble in the first character and low nibble in the second
+        auto v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        auto n = _mm256_or_si256(_mm256_srli_epi16(v, 4), _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x0F)), 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), _mm256_shuffle_epi8(digits, n));
+    }
+
+    encodeScalar(src + i, count - i, dst + i * 2);
+}
+#endif
+
+#ifdef HEX_NEON
+bool decodeNEON(const char* src, size_t count, uint8_t* dst, uint8_t& sum)
+{
+    auto valid = vdup_n_u8(0xFFU);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Loading as pairs splits the high and low digit of each byte
+        auto v = vld2_u8(reinterpret_cast<const uint8_t*>(src + i * 2));
+        uint8x8_t n[2];
+        for (int k = 0; k < 2; ++k) {
+            auto lower = vorr_u8(v.val[k], vdup_n_u8(0x20));
+            auto digit = vand_u8(vcge_u8(v.val[k], vdup_n_u8('0')), vcle_u8(v.val[k], vdup_n_u8('9')));
+            auto alpha = vand_u8(vcge_u8(lower, vdup_n_u8('a')), vcle_u8(lower, vdup_n_u8('f')));
+            valid = vand_u8(valid, vorr_u8(digit, alpha));
+            n[k] = vbsl_u8(digit, vsub_u8(v.val[k], vdup_n_u8('0')), vsub_u8(lower, vdup_n_u8('a' - 10)));
+        }
+
+        auto bytes = vorr_u8(vshl_n_u8(n[0], 4), n[1]);
+        vst1_u8(dst + i, bytes);
+        sum += vaddv_u8(bytes);
+    }
+
+    bool ok = vminv_u8(valid) == 0xFFU;
+    return decodeScalar(src + i * 2, count - i, dst + i, sum) && ok;
+}
+
+void encodeNEON(const uint8_t* src, size_t count, char* dst)
+{
+    const auto digits = vld1q_u8(reinterpret_cast<const uint8_t*>(sDigits));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto v = vld1q_u8(src + i);
+        uint8x16x2_t out;
+        out.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(v, 4));
+        out.val[1] = vqtbl1q_u8(digits, vandq_u8(v, vdupq_n_u8(0x0F)));
+        vst2q_u8(reinterpret_cast<uint8_t*>(dst + i * 2), out);
+    }
+
+    encodeScalar(src + i, count - i, dst + i * 2);
+}
+#endif
+
+using DecodeFn = bool (*)(const char*, size_t, uint8_t*, uint8_t&);
+using EncodeFn = void (*)(const uint8_t*, size_t, char*);
+
+// Picked once from what the CPU running us supports
+DecodeFn selectDecode()
+{
+#ifdef HEX_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return decodeAVX2;
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        return decodeSSSE3;
+    }
+#elif defined(HEX_NEON)
+    return decodeNEON;
+#endif
+    return decodeScalar;
+}
+
+EncodeFn selectEncode()
+{
+#ifdef HEX_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return encodeAVX2;
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        return encodeSSSE3;
+    }
+#elif defined(HEX_NEON)
+    return encodeNEON;
+#endif
+    return encodeScalar;
+}
+}
+
 std::vector<uint8_t> utils::Hex::fromString(const std::string& str, char padByte, bool canFail)
 {
-    std::vector<uint8_t> ret;
+    std::vector<uint8_t> ret(str.size() / 2);
+    if (str.size() % 2 == 0 && decode(str.data(), ret.size(), ret.data())) {
+        return ret;
+    }
+
+    // Strings with separators or an odd number of digits take the slow path
+    ret.clear();
     uint8_t last = 0;
     bool found = false;
     for (char c: str) {
@@ -46,18 +274,13 @@ std::vector<uint8_t> utils::Hex::fromString(uint16_t p)
 
 std::string utils::Hex::toString(const std::vector<uint8_t>& data)
 {
-    std::string ret;
-    for (uint8_t c: data) {
-        for (uint8_t i = 0; i < 2; ++i) {
-            uint8_t c1 = static_cast<uint8_t>(c >> static_cast<uint8_t>((1 - i) * 4U)) & 0x0FU;
-            if (c1 >= 0x0 && c1 <= 0x9) {
-                ret += static_cast<uint8_t>('0' + c1);
-            } else {
-                ret += static_cast<uint8_t>('A' + (c1 - 0xa));
-            }
-        }
-    }
+    return toString(data.data(), data.size());
+}
 
+std::string utils::Hex::toString(const uint8_t* data, size_t size)
+{
+    std::string ret(size * 2, '\0');
+    encode(data, size, &ret[0]);
     return ret;
 }
 
@@ -81,6 +304,18 @@ std::string utils::Hex::toASCII(const std::vector<uint8_t>& data)
     return toString(toString(data));
 }
 
+bool utils::Hex::decode(const char* src, size_t count, uint8_t* dst, uint8_t& sum)
+{
+    static const auto decoder = selectDecode();
+    return decoder(src, count, dst, sum);
+}
+
+void utils::Hex::encode(const uint8_t* src, size_t count, char* dst)
+{
+    static const auto encoder = selectEncode();
+    encoder(src, count, dst);
+}
+
 uint8_t utils::Hex::toNibble(char c, bool& error)
 {
     error = false;
@@ -0,0 +1,181 @@
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "utils/sha256.h"
+
+namespace {
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, uint32_t n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+void transformScalar(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+    for (; blocks > 0; --blocks, data += 64) {
+        uint32_t w[64];
+        for (size_t i = 0; i < 16; ++i) {
+            w[i] = (static_cast<uint32_t>(data[i * 4]) << 24) | (static_cast<uint32_t>(data[i * 4 + 1]) << 16)
+                | (static_cast<uint32_t>(data[i * 4 + 2]) << 8) | data[i * 4 + 3];
+        }
+
+        for (size_t i = 16; i < 64; ++i) {
+            auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        for (size_t i = 0; i < 64; ++i) {
+            auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA_X86
+// SHA extensions, four rounds per pair of sha256rnds2 with the state kept as ABEF/CDGH
+__attribute__((target("sha,sse4.1")))
+void transformSHA(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+    const auto mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    auto tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+    auto state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+    auto state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; --blocks, data += 64) {
+        auto abef = state0;
+        auto cdgh = state1;
+        __m128i m[4];
+        for (size_t i = 0; i < 16; ++i) {
+            if (i < 4) {
+                m[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)), mask);
+            } else {
+                auto& w = m[i % 4];
+                w = _mm_sha256msg1_epu32(w, m[(i + 1) % 4]);
+                w = _mm_add_epi32(w, _mm_alignr_epi8(m[(i + 3) % 4], m[(i + 2) % 4], 4));
+                w = _mm_sha256msg2_epu32(w, m[(i + 3) % 4]);
+            }
+
+            auto msg = _mm_add_epi32(m[i % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(K + i * 4)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+using TransformFn = void (*)(uint32_t*, const uint8_t*, size_t);
+
+TransformFn selectTransform()
+{
+#ifdef SHA_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (__builtin_cpu_supports("sse4.1") && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1U << 29)) != 0) {
+        return transformSHA;
+    }
+#endif
+    return transformScalar;
+}
+}
+
+utils::SHA256::SHA256()
+    : mState({0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19})
+{
+}
+
+utils::SHA256& utils::SHA256::update(const void* data, size_t size)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    mLength += size;
+    while (size > 0) {
+        if (mFill == 0 && size >= mBuffer.size()) {
+            auto blocks = size / mBuffer.size();
+            transform(p, blocks);
+            p += blocks * mBuffer.size();
+            size -= blocks * mBuffer.size();
+            continue;
+        }
+
+        auto n = std::min(size, mBuffer.size() - mFill);
+        memcpy(mBuffer.data() + mFill, p, n);
+        mFill += n;
+        p += n;
+        size -= n;
+        if (mFill == mBuffer.size()) {
+            transform(mBuffer.data(), 1);
+            mFill = 0;
+        }
+    }
+
+    return *this;
+}
+
+utils::SHA256::Digest utils::SHA256::digest()
+{
+    uint64_t bits = mLength * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padLen = (mFill < 56) ? 56 - mFill : 120 - mFill;
+    for (size_t i = 0; i < 8; ++i) {
+        pad[padLen + i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+    }
+
+    update(pad, padLen + 8);
+
+    Digest ret;
+    for (size_t i = 0; i < mState.size(); ++i) {
+        for (size_t j = 0; j < 4; ++j) {
+            ret[i * 4 + j] = static_cast<uint8_t>(mState[i] >> (24 - j * 8));
+        }
+    }
+
+    return ret;
+}
+
+void utils::SHA256::transform(const uint8_t* data, size_t blocks)
+{
+    static const auto transformer = selectTransform();
+    transformer(mState.data(), data, blocks);
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+
+#include "emulator.h"
+#include "ext/allocations.h"
+#include "flasher.h"
+#include "flashfile.h"
+#include "logger.h"
+
+// Runs the report path against the emulator and fails if it allocates per round trip: once warmed up,
+// writing, verifying and reading back a large image has to take no more allocations than a small one
+namespace {
+constexpr uint32_t BASE = 0x1D000000U;
+constexpr uint32_t APPINFO = 0x1D07F000U;
+constexpr uint32_t BOOTLOADER = 0x1FC00000U;
+constexpr uint32_t RECORD = 16;
+
+// Plaintext records of RECORD bytes, each followed by the two byte trailer the bootloader expects
+std::string image(uint32_t records)
+{
+    auto line = [](uint8_t type, uint16_t address, const std::vector<uint8_t>& data) {
+        char buf[16];
+        std::string ret = ":";
+        uint8_t sum = data.size() + (address >> 8U) + address + type;
+        snprintf(buf, sizeof(buf), "%02X%04X%02X", static_cast<unsigned>(data.size()), address, type);
+        ret += buf;
+        for (auto b: data) {
+            snprintf(buf, sizeof(buf), "%02X", b);
+            ret += buf;
+            sum += b;
+        }
+
+        snprintf(buf, sizeof(buf), "%02X\n", static_cast<uint8_t>(-sum));
+        return ret + buf;
+    };
+
+    std::string ret;
+    for (uint32_t i = 0; i < records; ++i) {
+        const uint32_t address = BASE + i * RECORD;
+        if (i == 0 || (address & 0xFFFFU) == 0) {
+            ret += line(0x04U, 0, {static_cast<uint8_t>(address >> 24U), static_cast<uint8_t>(address >> 16U)});
+        }
+
+        std::vector<uint8_t> data(RECORD + 2);
+        for (uint32_t j = 0; j < data.size(); ++j) {
+            data[j] = static_cast<uint8_t>((address + j) * 7U);
+        }
+
+        ret += line(0x00U, static_cast<uint16_t>(address), data);
+    }
+
+    // App info: id, version 1, length, version digits, then the app and bootloader versions and names
+    std::vector<uint8_t> appInfo = {0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 1, 0, 0, 0, 0x80, 0, 0, 0, 8, 16, 8, 16};
+    const std::pair<const char*, size_t> fields[] = {{"1.0", 8}, {"test", 16}, {"b1.0", 8}, {"boot", 16}};
+    for (const auto& f: fields) {
+        for (size_t i = 0; i < f.second; ++i) {
+            appInfo.push_back(i < strlen(f.first) ? f.first[i] : 0);
+        }
+    }
+
+    appInfo.resize(appInfo.size() + 4, 0);
+    ret += line(0x04U, 0, {static_cast<uint8_t>(APPINFO >> 24U), static_cast<uint8_t>(APPINFO >> 16U)});
+    for (size_t i = 0; i < appInfo.size(); i += RECORD) {
+        auto end = std::min(appInfo.size(), i + RECORD);
+        ret += line(0x00U, static_cast<uint16_t>(APPINFO + i), std::vector<uint8_t>(appInfo.begin() + i, appInfo.begin() + end));
+    }
+
+    return ret;
+}
+
+std::unique_ptr<FlashFile> load(const std::string& path, uint32_t records, const DeviceInfo& info)
+{
+    std::ofstream(path) << image(records);
+    return std::make_unique<FlashFile>(path, info);
+}
+
+// Allocations of op on the small and the large case, after a warm-up run on the small one
+bool check(const char* name, const std::function<bool(bool)>& prepare, const std::function<bool(bool)>& op)
+{
+    if (!prepare(false) || !op(false)) {
+        Logger::error("allocations") << name << "failed";
+        return false;
+    }
+
+    uint64_t counts[2];
+    for (bool large: {false, true}) {
+        if (!prepare(large)) {
+            Logger::error("allocations") << name << "failed";
+            return false;
+        }
+
+        auto before = ext::Allocations::count();
+        if (!op(large)) {
+            Logger::error("allocations") << name << "failed";
+            return false;
+        }
+
+        counts[large] = ext::Allocations::count() - before;
+    }
+
+    bool ok = counts[1] <= counts[0];
+    (ok ? Logger::info("allocations") : Logger::error("allocations")) ("%s: %llu allocations small, %llu large", name,
+        static_cast<unsigned long long>(counts[0]), static_cast<unsigned long long>(counts[1]));
+    return ok;
+}
+}
+
+int main()
+{
+    Logger::start();
+    std::atexit([]() {
+        Logger::stop();
+    });
+
+    auto emulator = std::make_shared<Emulator>();
+    HID::setBus(emulator);
+
+    Flasher flasher;
+    flasher.setWindow(8);
+    if (!flasher.switchMode(Flasher::MODE_BOOT)) {
+        return 1;
+    }
+
+    auto info = flasher.deviceInfo();
+    if (!info) {
+        return 1;
+    }
+
+    std::unique_ptr<FlashFile> files[] = {load("allocations-small.hex", 64, *info), load("allocations-large.hex", 2048, *info)};
+    if (!*files[0] || !*files[1]) {
+        Logger::error("allocations") << "Could not build the test images";
+        return 1;
+    }
+
+    auto none = [](bool) { return true; };
+    bool ok = true;
+    ok = check("write", [&](bool) { return flasher.erase(); }, [&](bool large) {
+        return flasher.flash(*files[large], *info);
+    }) && ok;
+    ok = check("verify", none, [&](bool large) {
+        return flasher.verify(*files[large], *info);
+    }) && ok;
+    ok = check("read", none, [&](bool large) {
+        return flasher.readData(BASE, large ? 2048 * RECORD : 64 * RECORD).size() == (large ? 2048 * RECORD : 64 * RECORD);
+    }) && ok;
+    // The boot flash refuses CMD_GET_DATA, so every byte of it is probed with verify
+    ok = check("probe", none, [&](bool large) {
+        return flasher.readData(BOOTLOADER, large ? 2048 : 256).size() == (large ? 2048U : 256U);
+    }) && ok;
+
+    return ok ? 0 : 1;
+}